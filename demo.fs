@@ -0,0 +1,36 @@
+# In-Memory File System with Caching Demo
+# Run with: ./filesystem demo.fs --cache=3
+
+echo --- Step 1: CREATE files (Allocation) ---
+create file1.txt content1
+create file2.txt content2
+create file3.txt content3
+ls
+
+echo --- Step 2: READ files to populate cache ---
+read file1.txt
+read file2.txt
+
+echo --- Step 3: WRITE to an existing file ---
+write file1.txt new_content1
+read file1.txt
+
+echo --- Step 4: DELETE a file (Deallocation) ---
+delete file2.txt
+read file2.txt
+ls
+
+echo --- Step 5: Atomic transaction ---
+begin
+create file4.txt content4
+write file3.txt new_content3
+rename file1.txt renamed1.txt
+commit
+begin
+delete file3.txt
+delete missing.txt
+commit
+ls
+
+echo --- Step 6: Cache statistics ---
+stats
@@ -1,6 +1,3 @@
-This is the complete and corrected C++ source file with all the features you wanted.
-
-```cpp
 // In-Memory File System with Advanced Caching
 // Features: Create, Read, Write, Delete, LRU & LFU Caches
 
@@ -10,281 +7,5666 @@ This is the complete and corrected C++ source file with all the features you wan
 #include <memory>
 #include <chrono>
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
 #include <algorithm>
 #include <queue>
+#include <list>
+#include <cstdint>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <random>
+#include <sstream>
+#include <deque>
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <limits>
+#include <climits>
+#include <ctime>
+#include <cerrno>
+#include <stdexcept>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <csignal>
+#endif
 
 using namespace std;
 
+// ========================= ALLOCATION INSTRUMENTATION =========================
+// Built with -DFS_COUNT_ALLOCS (`make alloc`), the global operator new counts
+// every heap allocation into each AllocScope active on the calling thread.
+// Scopes nest, so an LRU call made inside readFile counts towards both tags.
+// In the default build ALLOC_SCOPE compiles to nothing.
+struct AllocCounters {
+    string tag;
+    atomic<uint64_t> calls{0};
+    atomic<uint64_t> allocations{0};
+    atomic<uint64_t> bytes{0};
+    AllocCounters(const string& t) : tag(t) {}
+};
+
+class AllocRegistry {
+private:
+    static mutex& registryMutex() {
+        static mutex m;
+        return m;
+    }
+    static deque<AllocCounters>& registry() {
+        static deque<AllocCounters> tags;
+        return tags;
+    }
+public:
+    static atomic<uint64_t> totalAllocations;
+    static atomic<uint64_t> totalBytes;
+
+    static AllocCounters& get(const string& tag) {
+        lock_guard<mutex> lock(registryMutex());
+        for (auto& c : registry()) {
+            if (c.tag == tag) return c;
+        }
+        registry().emplace_back(tag);
+        return registry().back();
+    }
+    template<typename F>
+    static void forEach(F f) {
+        lock_guard<mutex> lock(registryMutex());
+        for (auto& c : registry()) f(c);
+    }
+    static void resetAll() {
+        forEach([](AllocCounters& c) { c.calls = 0; c.allocations = 0; c.bytes = 0; });
+    }
+};
+atomic<uint64_t> AllocRegistry::totalAllocations{0};
+atomic<uint64_t> AllocRegistry::totalBytes{0};
+
+class AllocScope {
+private:
+    AllocCounters& counters;
+    AllocScope* parent;
+    static thread_local AllocScope* current;
+public:
+    AllocScope(AllocCounters& c) : counters(c), parent(current) {
+        current = this;
+        counters.calls.fetch_add(1, memory_order_relaxed);
+    }
+    ~AllocScope() { current = parent; }
+
+    static void record(size_t bytes) {
+        AllocRegistry::totalAllocations.fetch_add(1, memory_order_relaxed);
+        AllocRegistry::totalBytes.fetch_add(bytes, memory_order_relaxed);
+        for (AllocScope* s = current; s; s = s->parent) {
+            s->counters.allocations.fetch_add(1, memory_order_relaxed);
+            s->counters.bytes.fetch_add(bytes, memory_order_relaxed);
+        }
+    }
+};
+thread_local AllocScope* AllocScope::current = nullptr;
+
+#ifdef FS_COUNT_ALLOCS
+#define ALLOC_SCOPE(tag) \
+    static AllocCounters& allocCounters_ = AllocRegistry::get(tag); \
+    AllocScope allocScope_(allocCounters_)
+
+// GCC pairs the inlined malloc/free against the builtin new/delete and warns
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void* operator new(size_t size) {
+    AllocScope::record(size);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+#pragma GCC diagnostic pop
+#else
+#define ALLOC_SCOPE(tag) do {} while (0)
+#endif
+
+// ========================= HOT-PATH PHASE TIMERS =========================
+// Sampled cycle counters for the phases of readFile. One read in N (per
+// thread) carries a PhaseTimer; the others pass a null timer and pay a single
+// branch per phase boundary. Durations go into log2 histograms of cycles.
+enum class ReadPhase { Hash, Probe, ListUpdate, Copy, Fetch, Accounting, Count };
+
+inline const char* readPhaseName(ReadPhase p) {
+    static const char* names[] = {"hash", "index probe", "list update", "value copy",
+                                  "backend fetch", "accounting"};
+    return names[static_cast<int>(p)];
+}
+
+inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+class PhaseProfile {
+private:
+    static constexpr int PHASES = static_cast<int>(ReadPhase::Count);
+    static constexpr int BUCKETS = 64;
+    struct Histogram {
+        atomic<uint64_t> count{0};
+        atomic<uint64_t> total{0};
+        atomic<uint64_t> buckets[BUCKETS] = {};
+    };
+    Histogram histograms[PHASES];
+    atomic<uint32_t> sampleEvery{0};
+
+    uint64_t percentile(const Histogram& h, double q) const {
+        uint64_t target = static_cast<uint64_t>(q * h.count), seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += h.buckets[b];
+            if (seen > target) return b == 0 ? 0 : (1ull << b) - 1;
+        }
+        return 0;
+    }
+public:
+    // 0 disables sampling
+    void setSampleEvery(uint32_t n) { sampleEvery = n; }
+
+    bool shouldSample() {
+        uint32_t every = sampleEvery.load(memory_order_relaxed);
+        if (every == 0) return false;
+        thread_local uint32_t countdown = 0;
+        if (countdown == 0) {
+            countdown = every - 1;   // this read plus every - 1 skipped
+            return true;
+        }
+        countdown--;
+        return false;
+    }
+
+    void record(ReadPhase phase, uint64_t cycles) {
+        Histogram& h = histograms[static_cast<int>(phase)];
+        int bucket = cycles ? 64 - __builtin_clzll(cycles) : 0;
+        h.count.fetch_add(1, memory_order_relaxed);
+        h.total.fetch_add(cycles, memory_order_relaxed);
+        h.buckets[min(bucket, BUCKETS - 1)].fetch_add(1, memory_order_relaxed);
+    }
+
+    // Measures the counter rate against steady_clock, for converting to ns
+    static double cyclesPerNs() {
+        static double rate = [] {
+            auto t0 = chrono::steady_clock::now();
+            uint64_t c0 = readCycles();
+            this_thread::sleep_for(chrono::milliseconds(20));
+            uint64_t c1 = readCycles();
+            double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count();
+            return (c1 - c0) / ns;
+        }();
+        return rate;
+    }
+
+    void print() const {
+        double perNs = cyclesPerNs();
+        cout << left << setw(16) << "phase" << right << setw(10) << "samples" << setw(14) << "mean cyc"
+             << setw(12) << "p50 cyc" << setw(12) << "p99 cyc" << setw(12) << "mean ns" << endl;
+        for (int p = 0; p < PHASES; p++) {
+            const Histogram& h = histograms[p];
+            if (h.count == 0) continue;
+            double mean = static_cast<double>(h.total) / h.count;
+            cout << left << setw(16) << readPhaseName(static_cast<ReadPhase>(p)) << right
+                 << setw(10) << h.count.load() << fixed << setprecision(1) << setw(14) << mean
+                 << setw(12) << percentile(h, 0.50) << setw(12) << percentile(h, 0.99)
+                 << setw(12) << mean / perNs << endl;
+        }
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+        cout << "(p50/p99 are log2 bucket upper bounds; " << fixed << setprecision(2) << perNs
+             << " cycles/ns)" << endl;
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+    }
+};
+
+class PhaseTimer {
+private:
+    PhaseProfile* profile;
+    uint64_t last = 0;
+public:
+    PhaseTimer(PhaseProfile& p) : profile(p.shouldSample() ? &p : nullptr) {
+        if (profile) last = readCycles();
+    }
+    // Null when this operation is not sampled
+    PhaseTimer* get() { return profile ? this : nullptr; }
+
+    void restart() { last = readCycles(); }
+    // Charges the time since the previous mark, minus `exclude`, to `phase`
+    uint64_t mark(ReadPhase phase, uint64_t exclude = 0) {
+        uint64_t now = readCycles();
+        uint64_t delta = now - last;
+        delta = delta > exclude ? delta - exclude : 0;
+        profile->record(phase, delta);
+        last = now;
+        return delta;
+    }
+};
+
+// ========================= COARSE CLOCK =========================
+// Wall-clock milliseconds cheap enough for hot paths. Where available this
+// is CLOCK_REALTIME_COARSE, answered by the vDSO at timer-tick resolution
+// (1-4 ms) without a system call. No background thread is involved: a
+// single-threaded process keeps libstdc++'s non-atomic shared_ptr counts.
+class CoarseClock {
+public:
+    static uint64_t nowMs() {
+#ifdef CLOCK_REALTIME_COARSE
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000 + static_cast<uint64_t>(ts.tv_nsec) / 1000000;
+#else
+        return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+#endif
+    }
+    // Monotonic nanoseconds at the same tick resolution
+    static uint64_t monotonicNs() {
+#ifdef CLOCK_MONOTONIC_COARSE
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+#else
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+};
+
+// ========================= TIMER WHEEL =========================
+// Hierarchical timing wheel (Varghese & Lauck) with one-millisecond ticks:
+// LEVELS levels of 64 slots cover about 12 days, and later deadlines are
+// parked in the top level until they come into range. Timers live in a
+// pooled array linked by index, so schedule and cancel are O(1) and do not
+// allocate once the pool has grown. A higher-level slot is cascaded down
+// each time the level below wraps.
+template<typename T>
+class TimerWheel {
+public:
+    using Handle = uint32_t;
+    static constexpr Handle NONE = UINT32_MAX;
+private:
+    static constexpr int BITS = 6;
+    static constexpr size_t SLOTS = 1 << BITS;
+    static constexpr int LEVELS = 5;
+    struct Timer {
+        T item;
+        uint64_t deadline;
+        Handle prev, next;
+        uint32_t slot;   // index into slots, so cancel needs no search
+    };
+    vector<Timer> timers;
+    Handle freeList = NONE;
+    Handle slots[LEVELS * SLOTS];
+    size_t levelCount[LEVELS] = {};
+    uint64_t nextTick;   // first tick not yet processed
+    size_t armed = 0;
+
+    void link(Handle h) {
+        Timer& t = timers[h];
+        uint64_t when = max(t.deadline, nextTick);
+        uint64_t delta = when - nextTick;
+        if (delta >= (1ull << (BITS * LEVELS))) {
+            when = nextTick + (1ull << (BITS * LEVELS)) - 1;
+            delta = when - nextTick;
+        }
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (1ull << (BITS * (level + 1)))) level++;
+        t.slot = level * SLOTS + ((when >> (BITS * level)) & (SLOTS - 1));
+        levelCount[level]++;
+        Handle& head = slots[t.slot];
+        t.prev = NONE;
+        t.next = head;
+        if (head != NONE) timers[head].prev = h;
+        head = h;
+    }
+    void unlink(Handle h) {
+        Timer& t = timers[h];
+        if (t.prev != NONE) timers[t.prev].next = t.next;
+        else slots[t.slot] = t.next;
+        if (t.next != NONE) timers[t.next].prev = t.prev;
+        levelCount[t.slot / SLOTS]--;
+    }
+    void cascade(int level, size_t slot) {
+        Handle h = slots[level * SLOTS + slot];
+        slots[level * SLOTS + slot] = NONE;
+        while (h != NONE) {
+            Handle next = timers[h].next;
+            levelCount[level]--;
+            link(h);
+            h = next;
+        }
+    }
+public:
+    TimerWheel(uint64_t now) : nextTick(now) {
+        fill(begin(slots), end(slots), NONE);
+    }
+
+    Handle schedule(T item, uint64_t deadline) {
+        Handle h;
+        if (freeList != NONE) {
+            h = freeList;
+            freeList = timers[h].next;
+            timers[h].item = move(item);
+        } else {
+            h = static_cast<Handle>(timers.size());
+            timers.push_back({move(item), 0, NONE, NONE, 0});
+        }
+        timers[h].deadline = deadline;
+        link(h);
+        armed++;
+        return h;
+    }
+    void cancel(Handle h) {
+        unlink(h);
+        timers[h].next = freeList;
+        freeList = h;
+        armed--;
+    }
+    void reschedule(Handle h, uint64_t deadline) {
+        unlink(h);
+        timers[h].deadline = deadline;
+        link(h);
+    }
+    size_t size() const { return armed; }
+
+    // Fires the timers due at or before `now`, at most `limit` of them, and
+    // returns how many fired. Work left over by the limit is picked up by the
+    // next call.
+    template<typename F>
+    size_t advance(uint64_t now, size_t limit, F&& fire) {
+        if (armed == 0) {
+            nextTick = max(nextTick, now + 1);
+            return 0;
+        }
+        size_t fired = 0;
+        while (nextTick <= now) {
+            // With the lower levels empty, nothing happens before the next
+            // tick that cascades the lowest occupied level
+            int lowest = 0;
+            while (lowest < LEVELS - 1 && levelCount[lowest] == 0) lowest++;
+            if (lowest > 0) {
+                uint64_t span = 1ull << (BITS * lowest);
+                uint64_t boundary = (nextTick + span - 1) & ~(span - 1);
+                if (boundary != nextTick) {
+                    nextTick = min(boundary, now + 1);
+                    continue;
+                }
+            }
+            size_t index = nextTick & (SLOTS - 1);
+            if (index == 0) {
+                for (int level = 1; level < LEVELS; level++) {
+                    size_t slot = (nextTick >> (BITS * level)) & (SLOTS - 1);
+                    cascade(level, slot);
+                    if (slot != 0) break;
+                }
+            }
+            Handle& head = slots[index];
+            while (head != NONE) {
+                Handle h = head;
+                if (timers[h].deadline > nextTick) {   // parked beyond the wheel's range
+                    unlink(h);
+                    link(h);
+                    continue;
+                }
+                if (fired == limit) return fired;
+                unlink(h);
+                T item = move(timers[h].item);
+                timers[h].next = freeList;
+                freeList = h;
+                armed--;
+                fire(item);
+                fired++;
+            }
+            nextTick++;
+        }
+        return fired;
+    }
+};
+
 // ========================= LRU CACHE IMPLEMENTATION =========================
+// Entries put with a TTL expire lazily when a lookup finds them stale, and
+// proactively when expire() drains the timer wheel in batches.
+//
+// Each priority class has its own recency list and pinned entries sit on a
+// list of their own, so eviction takes the tail of the lowest non-empty
+// class without scanning and never reaches a pinned entry. When every entry
+// is pinned, put() declines new keys and returns false.
+enum class CachePriority : uint8_t { Low, Normal, High };
+
+inline const char* priorityName(CachePriority p) {
+    switch (p) {
+        case CachePriority::Low: return "low";
+        case CachePriority::Normal: return "normal";
+        case CachePriority::High: return "high";
+    }
+    return "unknown";
+}
+
 template<typename K, typename V>
 class LRUCache {
 private:
+    static constexpr int PINNED = 3;
+    static constexpr int LISTS = 4;   // one per CachePriority, then pinned
+    struct Node;
+    using Wheel = TimerWheel<Node*>;
     struct Node {
         K key;
         V value;
         shared_ptr<Node> prev, next;
-        Node(K k, V v) : key(k), value(v) {}
+        uint64_t expiresAt = 0;   // CoarseClock ms, 0 = never
+        typename Wheel::Handle timer = Wheel::NONE;
+        CachePriority priority = CachePriority::Normal;
+        bool pinned = false;
+        Node(K k, V v) : key(move(k)), value(move(v)) {}
+        int list() const { return pinned ? PINNED : static_cast<int>(priority); }
     };
     size_t capacity;
     unordered_map<K, shared_ptr<Node>> cache;
-    shared_ptr<Node> head, tail;
+    shared_ptr<Node> heads[LISTS], tails[LISTS];
+    Wheel wheel{CoarseClock::nowMs()};
+
+    static bool stale(const Node& node) {
+        return node.expiresAt && node.expiresAt <= CoarseClock::nowMs();
+    }
+    void setExpiry(Node* node, uint64_t ttlMs) {
+        if (ttlMs) {
+            uint64_t now = CoarseClock::nowMs();
+            // expire() skips an empty wheel, so bring its cursor up to date
+            if (!wheel.size()) wheel.advance(now, 0, [](Node*) {});
+            node->expiresAt = now + ttlMs;
+            if (node->timer == Wheel::NONE) node->timer = wheel.schedule(node, node->expiresAt);
+            else wheel.reschedule(node->timer, node->expiresAt);
+        } else if (node->timer != Wheel::NONE) {
+            wheel.cancel(node->timer);
+            node->timer = Wheel::NONE;
+            node->expiresAt = 0;
+        }
+    }
+    void erase(typename unordered_map<K, shared_ptr<Node>>::iterator it) {
+        setExpiry(it->second.get(), 0);
+        removeNode(it->second);
+        cache.erase(it);
+    }
+    // Least recently used entry of the lowest non-empty class, or nullptr
+    shared_ptr<Node> victim() const {
+        for (int l = 0; l < PINNED; l++) {
+            if (heads[l]->next != tails[l]) return tails[l]->prev;
+        }
+        return nullptr;
+    }
 
-    void addToHead(shared_ptr<Node> node) {
+    void addToHead(const shared_ptr<Node>& node) {
+        const shared_ptr<Node>& head = heads[node->list()];
         node->prev = head;
         node->next = head->next;
         head->next->prev = node;
         head->next = node;
     }
-    void removeNode(shared_ptr<Node> node) {
+    void removeNode(const shared_ptr<Node>& node) {
         node->prev->next = node->next;
         node->next->prev = node->prev;
     }
-    void moveToHead(shared_ptr<Node> node) {
+    void moveToHead(const shared_ptr<Node>& node) {
+        // Copy first: unlinking drops the list's references to the node
+        shared_ptr<Node> keep = node;
+        removeNode(keep);
+        addToHead(keep);
+    }
+    // Changes the node's list; it lands at the head of the new one
+    template<typename F>
+    bool relist(const K& key, F&& change) {
+        auto it = cache.find(key);
+        if (it == cache.end()) return false;
+        shared_ptr<Node> node = it->second;
         removeNode(node);
+        change(*node);
         addToHead(node);
+        return true;
     }
 public:
     LRUCache(size_t cap) : capacity(cap) {
-        head = make_shared<Node>(K{}, V{});
-        tail = make_shared<Node>(K{}, V{});
-        head->next = tail;
-        tail->prev = head;
+        for (int l = 0; l < LISTS; l++) {
+            heads[l] = make_shared<Node>(K{}, V{});
+            tails[l] = make_shared<Node>(K{}, V{});
+            heads[l]->next = tails[l];
+            tails[l]->prev = heads[l];
+        }
+    }
+    // prev/next shared_ptrs form cycles, so the lists have to be unlinked by hand
+    ~LRUCache() {
+        for (auto& head : heads) {
+            for (auto node = head; node; ) {
+                auto next = node->next;
+                node->prev.reset();
+                node->next.reset();
+                node = next;
+            }
+        }
     }
+    LRUCache(const LRUCache&) = delete;
+    LRUCache& operator=(const LRUCache&) = delete;
+    LRUCache(LRUCache&&) = default;
+    LRUCache& operator=(LRUCache&&) = default;
     V get(const K& key) {
+        ALLOC_SCOPE("lru.get");
         auto it = cache.find(key);
         if (it == cache.end()) return V{};
+        if (stale(*it->second)) {
+            erase(it);
+            return V{};
+        }
         moveToHead(it->second);
         return it->second->value;
     }
-    void put(const K& key, const V& value) {
+    // Copies into the caller's buffer, reusing its storage; false on a miss
+    bool get(const K& key, V& out, PhaseTimer* timer = nullptr) {
+        const V* value = lookup(key, timer);
+        if (!value) return false;
+        out = *value;
+        if (timer) timer->mark(ReadPhase::Copy);
+        return true;
+    }
+    // Promotes the entry and returns its value in place, or nullptr on a miss.
+    // A sampled timer gets the hash computed separately so the probe can be
+    // charged without it.
+    const V* lookup(const K& key, PhaseTimer* timer = nullptr) {
+        ALLOC_SCOPE("lru.get");
+        uint64_t hashCycles = 0;
+        if (timer) {
+            timer->restart();
+            volatile size_t h = cache.hash_function()(key);
+            (void)h;
+            hashCycles = timer->mark(ReadPhase::Hash);
+        }
         auto it = cache.find(key);
-        if (it != cache.end()) {
-            it->second->value = value;
-            moveToHead(it->second);
-        } else {
-            if (cache.size() >= capacity) {
-                auto tail_prev = tail->prev;
-                removeNode(tail_prev);
-                cache.erase(tail_prev->key);
-            }
-            auto newNode = make_shared<Node>(key, value);
-            addToHead(newNode);
-            cache[key] = newNode;
+        if (timer) timer->mark(ReadPhase::Probe, hashCycles);
+        if (it == cache.end()) return nullptr;
+        if (stale(*it->second)) {
+            erase(it);
+            return nullptr;
         }
+        moveToHead(it->second);
+        if (timer) timer->mark(ReadPhase::ListUpdate);
+        return &it->second->value;
+    }
+    // A ttlMs of 0 stores the entry without expiry, clearing any earlier TTL.
+    // Returns false if the key could not be stored.
+    bool put(const K& key, const V& value, uint64_t ttlMs = 0, CachePriority priority = CachePriority::Normal) {
+        return insert(key, value, ttlMs, priority);
+    }
+    bool put(const K& key, V&& value, uint64_t ttlMs = 0, CachePriority priority = CachePriority::Normal) {
+        return insert(key, move(value), ttlMs, priority);
+    }
+    bool setTtl(const K& key, uint64_t ttlMs) {
+        auto it = cache.find(key);
+        if (it == cache.end()) return false;
+        setExpiry(it->second.get(), ttlMs);
+        return true;
+    }
+    // Pinned entries still count toward capacity and still expire by TTL
+    bool pin(const K& key) { return relist(key, [](Node& n) { n.pinned = true; }); }
+    bool unpin(const K& key) { return relist(key, [](Node& n) { n.pinned = false; }); }
+    bool setPriority(const K& key, CachePriority priority) {
+        return relist(key, [priority](Node& n) { n.priority = priority; });
     }
     void remove(const K& key) {
+        ALLOC_SCOPE("lru.remove");
+        auto it = cache.find(key);
+        if (it != cache.end()) erase(it);
+    }
+    // Drops every entry whose key satisfies `pred`; O(size)
+    template<typename Pred>
+    size_t removeIf(Pred pred) {
+        size_t removed = 0;
+        for (auto it = cache.begin(); it != cache.end(); ) {
+            if (pred(it->first)) erase(it++), removed++;
+            else ++it;
+        }
+        return removed;
+    }
+    bool contains(const K& key) const { return cache.count(key) != 0; }
+    size_t size() const { return cache.size(); }
+    size_t getCapacity() const { return capacity; }
+    // Growing takes effect at once. Shrinking only lowers the limit; the
+    // excess goes through shrink() in bounded batches, a put of a new key
+    // over the limit recycles a victim as usual, and a put of an existing
+    // key always replaces its value, even at capacity 0.
+    void resize(size_t newCapacity) { capacity = newCapacity; }
+    // Evicts up to `limit` entries while over capacity; returns how many
+    size_t shrink(size_t limit) {
+        ALLOC_SCOPE("lru.shrink");
+        size_t evicted = 0;
+        while (evicted < limit && cache.size() > capacity) {
+            auto node = victim();
+            if (!node) break;
+            erase(cache.find(node->key));
+            evicted++;
+        }
+        return evicted;
+    }
+    // Drops up to `limit` entries whose TTL has passed; returns how many
+    // and appends their keys to `expired` if given
+    size_t expire(size_t limit, vector<K>* expired = nullptr) {
+        if (!wheel.size()) return 0;   // no TTLs: skip the clock read
+        return wheel.advance(CoarseClock::nowMs(), limit, [this, expired](Node* node) {
+            node->timer = Wheel::NONE;
+            if (expired) expired->push_back(node->key);
+            erase(cache.find(node->key));
+        });
+    }
+private:
+    template<typename VV>
+    bool insert(const K& key, VV&& value, uint64_t ttlMs, CachePriority priority) {
+        ALLOC_SCOPE("lru.put");
+        // An existing key is always updated, even over capacity, so a put
+        // never leaves the old value behind
         auto it = cache.find(key);
         if (it != cache.end()) {
-            removeNode(it->second);
-            cache.erase(it);
+            shared_ptr<Node> node = it->second;
+            node->value = forward<VV>(value);
+            setExpiry(node.get(), ttlMs);
+            removeNode(node);
+            node->priority = priority;
+            addToHead(node);
+        } else if (capacity == 0) {
+            return false;
+        } else if (cache.size() >= capacity) {
+            // Recycle the evicted node and its hash entry instead of reallocating
+            auto node = victim();
+            if (!node) return false;
+            removeNode(node);
+            auto entry = cache.extract(node->key);
+            node->key = key;
+            node->value = forward<VV>(value);
+            node->priority = priority;
+            node->pinned = false;
+            setExpiry(node.get(), ttlMs);
+            entry.key() = key;
+            addToHead(node);
+            cache.insert(move(entry));
+        } else {
+            auto newNode = make_shared<Node>(key, forward<VV>(value));
+            newNode->priority = priority;
+            setExpiry(newNode.get(), ttlMs);
+            addToHead(newNode);
+            cache[key] = newNode;
         }
+        return true;
     }
 };
 
 // ========================= LFU CACHE IMPLEMENTATION =========================
+// Frequency buckets are kept in ascending order, each holding its entries
+// oldest first, so the eviction victim is always at the front of the first
+// bucket. Entries move between buckets by list splicing and emptied buckets
+// are parked on a spare list, so a hit never allocates or scans.
+// TTLs work as in LRUCache. Priority classes and pinned entries each get a
+// bucket list of their own; eviction takes the first bucket of the lowest
+// non-empty class. Moving an entry between classes (pin, unpin,
+// setPriority) keeps its frequency by walking the target class's buckets.
+//
+// Optional aging keeps yesterday's hot set from squatting: frequencies stop
+// at maxFrequency, and every agingPeriod accesses all of them are halved in
+// one pass over the buckets. The period is never shorter than the cache
+// size, so that pass costs O(1) amortized per access.
 template<typename K, typename V>
 class LFUCache {
 private:
+    static constexpr int PINNED = 3;
+    static constexpr int CLASSES = 4;
+    struct Node;
+    struct Bucket;
+    using NodeList = list<Node>;
+    using BucketList = list<Bucket>;
+    using Wheel = TimerWheel<Node*>;
     struct Node {
         K key;
         V value;
+        typename BucketList::iterator bucket;
+        uint64_t expiresAt = 0;
+        typename Wheel::Handle timer = Wheel::NONE;
+        CachePriority priority = CachePriority::Normal;
+        bool pinned = false;
+        Node(const K& k, V v) : key(k), value(move(v)) {}
+        int cls() const { return pinned ? PINNED : static_cast<int>(priority); }
+    };
+    struct Bucket {
         int frequency;
-        Node(K k, V v) : key(k), value(v), frequency(1) {}
+        NodeList nodes;
     };
     size_t capacity;
-    unordered_map<K, shared_ptr<Node>> keyToNode;
-    map<int, vector<shared_ptr<Node>>> freqToNodes;
-    int minFreq;
+    unordered_map<K, typename NodeList::iterator> keyToNode;
+    BucketList buckets[CLASSES];
+    BucketList spareBuckets;
+    Wheel wheel{CoarseClock::nowMs()};
+    uint64_t agingPeriod = 0;       // accesses between halvings, 0 = never
+    int maxFrequency = INT_MAX;
+    uint64_t sinceAging = 0;
+
+    static bool stale(const Node& node) {
+        return node.expiresAt && node.expiresAt <= CoarseClock::nowMs();
+    }
+    void setExpiry(Node* node, uint64_t ttlMs) {
+        if (ttlMs) {
+            uint64_t now = CoarseClock::nowMs();
+            // expire() skips an empty wheel, so bring its cursor up to date
+            if (!wheel.size()) wheel.advance(now, 0, [](Node*) {});
+            node->expiresAt = now + ttlMs;
+            if (node->timer == Wheel::NONE) node->timer = wheel.schedule(node, node->expiresAt);
+            else wheel.reschedule(node->timer, node->expiresAt);
+        } else if (node->timer != Wheel::NONE) {
+            wheel.cancel(node->timer);
+            node->timer = Wheel::NONE;
+            node->expiresAt = 0;
+        }
+    }
+    void erase(typename unordered_map<K, typename NodeList::iterator>::iterator it) {
+        setExpiry(&*it->second, 0);
+        auto b = it->second->bucket;
+        int cls = it->second->cls();
+        b->nodes.erase(it->second);
+        keyToNode.erase(it);
+        releaseIfEmpty(cls, b);
+    }
+
+    // Returns a bucket for `frequency` placed before `pos` in class `cls`
+    typename BucketList::iterator bucketBefore(int cls, typename BucketList::iterator pos, int frequency) {
+        if (spareBuckets.empty()) spareBuckets.emplace_back();
+        buckets[cls].splice(pos, spareBuckets, spareBuckets.begin());
+        auto b = prev(pos);
+        b->frequency = frequency;
+        return b;
+    }
+    void releaseIfEmpty(int cls, typename BucketList::iterator b) {
+        if (b->nodes.empty()) spareBuckets.splice(spareBuckets.end(), buckets[cls], b);
+    }
+    void updateFrequency(typename NodeList::iterator node) {
+        bump(node);
+        // Clamped to the capacity at use, so a later resize keeps the bound
+        if (agingPeriod && ++sinceAging >= max<uint64_t>(agingPeriod, capacity)) age();
+    }
+    void bump(typename NodeList::iterator node) {
+        int cls = node->cls();
+        auto b = node->bucket;
+        if (b->frequency >= maxFrequency) {
+            b->nodes.splice(b->nodes.end(), b->nodes, node);   // capped: refresh recency only
+            return;
+        }
+        auto next = std::next(b);
+        int freq = b->frequency + 1;
+        if (next == buckets[cls].end() || next->frequency != freq) {
+            if (b->nodes.size() == 1) {
+                b->frequency = freq;   // sole entry: relabel the bucket in place
+                return;
+            }
+            next = bucketBefore(cls, next, freq);
+        }
+        next->nodes.splice(next->nodes.end(), b->nodes, node);
+        node->bucket = next;
+        releaseIfEmpty(cls, b);
+    }
+    typename BucketList::iterator firstBucket(int cls) {
+        BucketList& list = buckets[cls];
+        if (list.empty() || list.front().frequency != 1) return bucketBefore(cls, list.begin(), 1);
+        return list.begin();
+    }
+    // Lowest-frequency bucket of the lowest non-empty evictable class
+    int victimClass() const {
+        for (int c = 0; c < PINNED; c++) {
+            if (!buckets[c].empty()) return c;
+        }
+        return -1;
+    }
+    template<typename F>
+    bool reclass(const K& key, F&& change) {
+        auto it = keyToNode.find(key);
+        if (it == keyToNode.end()) return false;
+        auto node = it->second;
+        auto from = node->bucket;
+        int oldCls = node->cls();
+        change(*node);
+        int cls = node->cls();
+        if (cls == oldCls) return true;
+        auto pos = buckets[cls].begin();
+        while (pos != buckets[cls].end() && pos->frequency < from->frequency) ++pos;
+        auto target = pos != buckets[cls].end() && pos->frequency == from->frequency
+                          ? pos : bucketBefore(cls, pos, from->frequency);
+        target->nodes.splice(target->nodes.end(), from->nodes, node);
+        node->bucket = target;
+        releaseIfEmpty(oldCls, from);
+        return true;
+    }
 public:
-    LFUCache(size_t cap) : capacity(cap), minFreq(0) {}
+    LFUCache(size_t cap) : capacity(cap) {}
     V get(const K& key) {
+        ALLOC_SCOPE("lfu.get");
         auto it = keyToNode.find(key);
         if (it == keyToNode.end()) return V{};
+        if (stale(*it->second)) {
+            erase(it);
+            return V{};
+        }
         updateFrequency(it->second);
         return it->second->value;
     }
-    void put(const K& key, const V& value) {
-        if (capacity == 0) return;
+    // Counts an access without copying the value out
+    bool touch(const K& key) {
+        ALLOC_SCOPE("lfu.touch");
         auto it = keyToNode.find(key);
-        if (it != keyToNode.end()) {
-            it->second->value = value;
-            updateFrequency(it->second);
-        } else {
-            if (keyToNode.size() >= capacity) evictLFU();
-            auto newNode = make_shared<Node>(key, value);
-            keyToNode[key] = newNode;
-            freqToNodes[1].push_back(newNode);
-            minFreq = 1;
+        if (it == keyToNode.end()) return false;
+        if (stale(*it->second)) {
+            erase(it);
+            return false;
         }
+        updateFrequency(it->second);
+        return true;
     }
-    void remove(const K& key) {
+    // Counts an access and returns the cached value in place; nullptr on a miss
+    const V* lookup(const K& key) {
+        ALLOC_SCOPE("lfu.lookup");
         auto it = keyToNode.find(key);
-        if (it != keyToNode.end()) {
-            auto node = it->second;
-            int freq = node->frequency;
-            auto& list = freqToNodes[freq];
-            list.erase(find(list.begin(), list.end(), node));
-            if (list.empty() && freq == minFreq) {
-                 // This is a simplified removal, a full implementation would need to find the new minFreq
-            }
-            keyToNode.erase(it);
+        if (it == keyToNode.end()) return nullptr;
+        if (stale(*it->second)) {
+            erase(it);
+            return nullptr;
         }
+        updateFrequency(it->second);
+        return &it->second->value;
     }
-private:
-    void updateFrequency(shared_ptr<Node> node) {
-        int oldFreq = node->frequency;
-        auto& oldList = freqToNodes[oldFreq];
-        oldList.erase(find(oldList.begin(), oldList.end(), node));
-        if (oldList.empty() && oldFreq == minFreq) minFreq++;
-        node->frequency++;
-        freqToNodes[node->frequency].push_back(node);
+    bool put(const K& key, const V& value, uint64_t ttlMs = 0, CachePriority priority = CachePriority::Normal) {
+        return insert(key, value, ttlMs, priority);
     }
-    void evictLFU() {
-        auto& minFreqList = freqToNodes[minFreq];
-        auto nodeToEvict = minFreqList.front();
-        minFreqList.erase(minFreqList.begin());
-        keyToNode.erase(nodeToEvict->key);
+    bool put(const K& key, V&& value, uint64_t ttlMs = 0, CachePriority priority = CachePriority::Normal) {
+        return insert(key, move(value), ttlMs, priority);
     }
-};
-
-// ========================= FILE SYSTEM IMPLEMENTATION =========================
-class File {
-private:
-    string name;
-    string content;
-public:
-    File(const string& n, const string& c = "") : name(n), content(c) {}
-    string read() const { return content; }
-    void write(const string& c) { content = c; }
-};
-
-class Directory {
-private:
-    string name;
-    unordered_map<string, shared_ptr<File>> files;
-public:
-    Directory(const string& n) : name(n) {}
-    bool createFile(const string& fname, const string& content) {
-        if (files.count(fname)) return false;
-        files[fname] = make_shared<File>(fname, content);
+    bool setTtl(const K& key, uint64_t ttlMs) {
+        auto it = keyToNode.find(key);
+        if (it == keyToNode.end()) return false;
+        setExpiry(&*it->second, ttlMs);
         return true;
     }
-    shared_ptr<File> getFile(const string& fname) {
-        return files.count(fname) ? files[fname] : nullptr;
+    bool pin(const K& key) { return reclass(key, [](Node& n) { n.pinned = true; }); }
+    bool unpin(const K& key) { return reclass(key, [](Node& n) { n.pinned = false; }); }
+    bool setPriority(const K& key, CachePriority priority) {
+        return reclass(key, [priority](Node& n) { n.priority = priority; });
     }
-    bool deleteFile(const string& fname) {
-        return files.erase(fname) > 0;
+    // Caps frequencies at `cap` and halves them every `period` accesses
+    // (0 turns halving off); periods shorter than the capacity act as the
+    // capacity. Entries already above the cap keep their count until the
+    // next halving.
+    void setAging(uint64_t period, int cap = INT_MAX) {
+        agingPeriod = period;
+        maxFrequency = max(1, cap);
+        sinceAging = 0;
     }
-    void listFiles() const {
-        cout << "Files in " << name << ":" << endl;
-        for(const auto& pair : files) {
-            cout << "- " << pair.first << endl;
+    // Halves every frequency (minimum 1); buckets that meet are merged, the
+    // older one's entries first
+    void age() {
+        sinceAging = 0;
+        for (auto& list : buckets) {
+            for (auto b = list.begin(); b != list.end(); ) {
+                b->frequency = max(1, b->frequency / 2);
+                auto before = b == list.begin() ? list.end() : prev(b);
+                if (before != list.end() && before->frequency == b->frequency) {
+                    for (auto& n : b->nodes) n.bucket = before;
+                    before->nodes.splice(before->nodes.end(), b->nodes);
+                    spareBuckets.splice(spareBuckets.end(), list, b++);
+                } else {
+                    ++b;
+                }
+            }
+        }
+    }
+    void remove(const K& key) {
+        ALLOC_SCOPE("lfu.remove");
+        auto it = keyToNode.find(key);
+        if (it != keyToNode.end()) erase(it);
+    }
+    template<typename Pred>
+    size_t removeIf(Pred pred) {
+        size_t removed = 0;
+        for (auto it = keyToNode.begin(); it != keyToNode.end(); ) {
+            if (pred(it->first)) erase(it++), removed++;
+            else ++it;
+        }
+        return removed;
+    }
+    bool contains(const K& key) const { return keyToNode.count(key) != 0; }
+    size_t size() const { return keyToNode.size(); }
+    size_t getCapacity() const { return capacity; }
+    // Same contract as LRUCache::resize()/shrink()
+    void resize(size_t newCapacity) { capacity = newCapacity; }
+    size_t shrink(size_t limit) {
+        ALLOC_SCOPE("lfu.shrink");
+        size_t evicted = 0;
+        while (evicted < limit && keyToNode.size() > capacity) {
+            int cls = victimClass();
+            if (cls < 0) break;
+            erase(keyToNode.find(buckets[cls].front().nodes.front().key));
+            evicted++;
+        }
+        return evicted;
+    }
+    size_t expire(size_t limit, vector<K>* expired = nullptr) {
+        if (!wheel.size()) return 0;   // no TTLs: skip the clock read
+        return wheel.advance(CoarseClock::nowMs(), limit, [this, expired](Node* node) {
+            node->timer = Wheel::NONE;
+            if (expired) expired->push_back(node->key);
+            erase(keyToNode.find(node->key));
+        });
+    }
+private:
+    template<typename VV>
+    bool insert(const K& key, VV&& value, uint64_t ttlMs, CachePriority priority) {
+        ALLOC_SCOPE("lfu.put");
+        auto it = keyToNode.find(key);
+        if (it != keyToNode.end()) {
+            it->second->value = forward<VV>(value);
+            setExpiry(&*it->second, ttlMs);
+            reclass(key, [priority](Node& n) { n.priority = priority; });
+            updateFrequency(it->second);
+        } else if (capacity == 0) {
+            return false;
+        } else if (keyToNode.size() >= capacity) {
+            // Recycle the least frequently used node and its hash entry
+            int victimCls = victimClass();
+            if (victimCls < 0) return false;
+            auto victimBucket = buckets[victimCls].begin();
+            auto victim = victimBucket->nodes.begin();
+            auto entry = keyToNode.extract(victim->key);
+            victim->key = key;
+            victim->value = forward<VV>(value);
+            victim->priority = priority;
+            setExpiry(&*victim, ttlMs);
+            entry.key() = key;
+            int cls = victim->cls();
+            auto target = firstBucket(cls);
+            if (target != victimBucket) {
+                target->nodes.splice(target->nodes.end(), victimBucket->nodes, victim);
+                victim->bucket = target;
+                releaseIfEmpty(victimCls, victimBucket);
+            } else {
+                target->nodes.splice(target->nodes.end(), target->nodes, victim);
+            }
+            keyToNode.insert(move(entry));
+        } else {
+            int cls = static_cast<int>(priority);
+            auto target = firstBucket(cls);
+            target->nodes.emplace_back(key, forward<VV>(value));
+            auto node = prev(target->nodes.end());
+            node->bucket = target;
+            node->priority = priority;
+            setExpiry(&*node, ttlMs);
+            keyToNode[key] = node;
         }
+        return true;
     }
 };
 
-class FileSystem {
+// ========================= MISS-RATIO CURVE ESTIMATION =========================
+// SHARDS-style estimator: only keys whose hash falls below a sampling threshold
+// are tracked, and each ghost cache holds keys only, scaled down by the same
+// sampling rate. A 4x ghost therefore costs 4 * rate entries of the real cache.
+// splitmix64 finalizer; spreads std::hash output before sampling
+inline uint64_t mixHash(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+struct MrcPoint {
+    double multiplier;   // ghost capacity relative to the live cache
+    size_t capacity;     // equivalent full-scale capacity
+    double hitRatio;     // estimated hit ratio at that capacity
+};
+
+class MissRatioEstimator {
 private:
-    shared_ptr<Directory> root;
-    LRUCache<string, string> lruCache;
-    LFUCache<string, string> lfuCache;
+    struct Ghost {
+        double multiplier;
+        size_t capacity;
+        LRUCache<string, bool> keys;
+        uint64_t hits;
+        Ghost(double m, size_t fullCap, size_t scaledCap)
+            : multiplier(m), capacity(fullCap), keys(scaledCap), hits(0) {}
+    };
+    static constexpr uint64_t MODULUS = 1ull << 24;
+    double rate;
+    uint64_t threshold;
+    uint64_t sampledAccesses;
+    vector<Ghost> ghosts;
+
 public:
-    FileSystem(size_t cacheSize = 10) : lruCache(cacheSize), lfuCache(cacheSize) {
-        root = make_shared<Directory>("root");
+    // By default the rate is chosen so the 1x ghost tracks ~1024 keys, which keeps
+    // small caches exact (rate 1) and large caches cheap (rate >= 0.001).
+    MissRatioEstimator(size_t capacity, double samplingRate = 0.0,
+                       const vector<double>& multipliers = {0.5, 1.0, 2.0, 4.0})
+        : sampledAccesses(0) {
+        if (samplingRate <= 0.0) {
+            samplingRate = capacity ? 1024.0 / capacity : 1.0;
+        }
+        rate = min(1.0, max(0.001, samplingRate));
+        threshold = static_cast<uint64_t>(rate * MODULUS);
+        for (double m : multipliers) {
+            size_t fullCap = max<size_t>(1, static_cast<size_t>(llround(m * capacity)));
+            size_t scaledCap = max<size_t>(1, static_cast<size_t>(llround(fullCap * rate)));
+            ghosts.emplace_back(m, fullCap, scaledCap);
+        }
     }
 
-    // CREATE operation (File Allocation)
-    bool createFile(const string& name, const string& content = "") {
-        cout << "Attempting to CREATE '" << name << "'..." << endl;
-        if (root->createFile(name, content)) {
-            lruCache.put(name, content);
-            lfuCache.put(name, content);
-            cout << " -> Success." << endl;
-            return true;
+    // Creates and writes populate the ghosts like they populate the live cache,
+    // but only reads are counted towards the hit ratio.
+    void access(const string& key, bool isRead = true) {
+        if (mixHash(hash<string>{}(key)) % MODULUS >= threshold) return;
+        if (isRead) sampledAccesses++;
+        for (auto& g : ghosts) {
+            if (g.keys.get(key)) {
+                if (isRead) g.hits++;
+            } else {
+                g.keys.put(key, true);
+            }
         }
-        cout << " -> Failure (file may already exist)." << endl;
-        return false;
     }
 
-    // READ operation
-    string readFile(const string& name) {
-        cout << "Attempting to READ '" << name << "'..." << endl;
-        string cached_content = lruCache.get(name);
-        if (!cached_content.empty()) {
-            cout << " -> Success (from LRU Cache)." << endl;
-            lfuCache.get(name); // Update LFU frequency
-            return cached_content;
-        }
-        auto file = root->getFile(name);
-        if (file) {
-            cout << " -> Success (from disk)." << endl;
-            string content = file->read();
-            lruCache.put(name, content);
-            lfuCache.put(name, content);
-            return content;
-        }
-        cout << " -> Failure (file not found)." << endl;
-        return "Error: File not found.";
+    // A read of a name that does not exist misses at every capacity; it is
+    // counted, like the live cache counts it, but cached nowhere
+    void miss(const string& key) {
+        if (mixHash(hash<string>{}(key)) % MODULUS >= threshold) return;
+        sampledAccesses++;
     }
 
-    // WRITE operation
-    bool writeFile(const string& name, const string& content) {
-        cout << "Attempting to WRITE to '" << name << "'..." << endl;
-        auto file = root->getFile(name);
-        if (file) {
-            file->write(content);
-            lruCache.put(name, content); // Update cache
-            lfuCache.put(name, content); // Update cache
-            cout << " -> Success." << endl;
-            return true;
+    vector<MrcPoint> curve() const {
+        vector<MrcPoint> points;
+        for (const auto& g : ghosts) {
+            double ratio = sampledAccesses ? static_cast<double>(g.hits) / sampledAccesses : 0.0;
+            points.push_back({g.multiplier, g.capacity, ratio});
         }
-        cout << " -> Failure (file not found)." << endl;
-        return false;
+        return points;
     }
 
-    // DELETE operation (File Deallocation)
-    bool deleteFile(const string& name) {
-        cout << "Attempting to DELETE '" << name << "'..." << endl;
-        if (root->deleteFile(name)) {
-            lruCache.remove(name); // Invalidate cache
-            lfuCache.remove(name); // Invalidate cache
-            cout << " -> Success." << endl;
-            return true;
+    double samplingRate() const { return rate; }
+    uint64_t samples() const { return sampledAccesses; }
+
+    // Rescales the ghosts around a new live capacity at the same sampling
+    // rate. Ghost contents stay warm; the hit counts restart.
+    void resize(size_t capacity) {
+        for (auto& g : ghosts) {
+            g.capacity = max<size_t>(1, static_cast<size_t>(llround(g.multiplier * capacity)));
+            g.keys.resize(max<size_t>(1, static_cast<size_t>(llround(g.capacity * rate))));
+            g.keys.shrink(SIZE_MAX);
+            g.hits = 0;
         }
-        cout << " -> Failure (file not found)." << endl;
-        return false;
-    }
-    
-    void listFiles() const {
-        root->listFiles();
+        sampledAccesses = 0;
     }
 };
 
-// ========================= DEMO AND TESTING =========================
-int main() {
-    cout << "In-Memory File System with Caching Demo" << endl;
-    cout << string(40, '=') << endl;
-    FileSystem fs(3);
+// ========================= ADAPTIVE POLICY SELECTION =========================
+// Scores LRU against LFU on a hash-sampled subset of keys, SHARDS-style: a
+// ghost of each policy, sized to the full budget scaled by the sampling
+// rate, records which policy would have hit. Once the window holds EPOCH
+// sampled reads it names a winner if one leads by more than MARGIN, then
+// halves the window's counts: after the first verdict one comes every
+// EPOCH / 2 reads, weighing older reads down geometrically so the verdict
+// follows the recent past.
+class PolicyArbiter {
+public:
+    enum class Verdict { Hold, FavorLru, FavorLfu };
+private:
+    static constexpr uint64_t MODULUS = 1ull << 24;
+    static constexpr uint64_t EPOCH = 256;
+    static constexpr double MARGIN = 0.02;
+    double rate;
+    uint64_t threshold;
+    LRUCache<string, bool> lruGhost;
+    LFUCache<string, bool> lfuGhost;
+    uint64_t windowReads = 0, windowLruHits = 0, windowLfuHits = 0;
+    uint64_t reads = 0, lruHits = 0, lfuHits = 0;
+
+    static size_t scaled(size_t capacity, double rate) {
+        return max<size_t>(1, static_cast<size_t>(llround(capacity * rate)));
+    }
+public:
+    PolicyArbiter(size_t capacity, double samplingRate = 0.0)
+        : rate(min(1.0, max(0.001, samplingRate > 0.0 ? samplingRate : capacity ? 1024.0 / capacity : 1.0))),
+          threshold(static_cast<uint64_t>(rate * MODULUS)),
+          lruGhost(scaled(capacity, rate)), lfuGhost(scaled(capacity, rate)) {}
 
-    cout << "\n--- Step 1: CREATE files (Allocation) ---" << endl;
-    fs.createFile("file1.txt", "content1");
-    fs.createFile("file2.txt", "content2");
-    fs.createFile("file3.txt", "content3");
-    fs.listFiles();
+    Verdict access(const string& key, bool isRead = true) {
+        if (mixHash(hash<string>{}(key)) % MODULUS >= threshold) return Verdict::Hold;
+        bool lruHit = lruGhost.get(key);
+        bool lfuHit = lfuGhost.touch(key);
+        if (!lruHit) lruGhost.put(key, true);
+        if (!lfuHit) lfuGhost.put(key, true);
+        if (!isRead) return Verdict::Hold;
+        reads++, windowReads++;
+        lruHits += lruHit, windowLruHits += lruHit;
+        lfuHits += lfuHit, windowLfuHits += lfuHit;
+        if (windowReads < EPOCH) return Verdict::Hold;
+        Verdict v = Verdict::Hold;
+        if (windowLruHits > windowLfuHits + MARGIN * windowReads) v = Verdict::FavorLru;
+        else if (windowLfuHits > windowLruHits + MARGIN * windowReads) v = Verdict::FavorLfu;
+        windowReads /= 2, windowLruHits /= 2, windowLfuHits /= 2;
+        return v;
+    }
 
-    cout << "\n--- Step 2: READ files to populate cache ---" << endl;
-    fs.readFile("file1.txt");
-    fs.readFile("file2.txt");
+    void resize(size_t capacity) {
+        lruGhost.resize(scaled(capacity, rate));
+        lfuGhost.resize(scaled(capacity, rate));
+        lruGhost.shrink(SIZE_MAX);
+        lfuGhost.shrink(SIZE_MAX);
+    }
+    // Mirrors the live LFU's aging, with the period scaled to the sample
+    void setAging(uint64_t period, int maxFrequency) {
+        lfuGhost.setAging(period ? max<uint64_t>(1, llround(period * rate)) : 0, maxFrequency);
+    }
+    double lruHitRatio() const { return reads ? static_cast<double>(lruHits) / reads : 0.0; }
+    double lfuHitRatio() const { return reads ? static_cast<double>(lfuHits) / reads : 0.0; }
+};
 
-    cout << "\n--- Step 3: WRITE to an existing file ---" << endl;
-    fs.writeFile("file1.txt", "new_content1");
-    fs.readFile("file1.txt"); // Should be a cache hit with new content
+// ========================= LOCK PROFILING =========================
+// Mutex wrapper that attributes acquisitions, contention and wait time to a
+// named lock class. The uncontended path is a try_lock plus relaxed counters;
+// only contended acquisitions read the clock. An acquisition by a different
+// thread than the previous holder is counted as a migration: the lock's cache
+// line (and usually the data it protects) had to move between cores.
+struct alignas(64) LockClassStats {
+    string name;
+    atomic<uint64_t> acquisitions{0};
+    atomic<uint64_t> contended{0};
+    atomic<uint64_t> waitNs{0};
+    atomic<uint64_t> migrations{0};
+    LockClassStats(const string& n) : name(n) {}
 
-    cout << "\n--- Step 4: DELETE a file (Deallocation) ---" << endl;
-    fs.deleteFile("file2.txt");
-    fs.readFile("file2.txt"); // Should be a file not found error
-    fs.listFiles();
+    void reset() {
+        acquisitions = 0;
+        contended = 0;
+        waitNs = 0;
+        migrations = 0;
+    }
+};
 
-    return 0;
+class LockProfiler {
+private:
+    static mutex& registryMutex() {
+        static mutex m;
+        return m;
+    }
+    static deque<LockClassStats>& registry() {
+        static deque<LockClassStats> classes;
+        return classes;
+    }
+public:
+    static LockClassStats& lockClass(const string& name) {
+        lock_guard<mutex> lock(registryMutex());
+        for (auto& c : registry()) {
+            if (c.name == name) return c;
+        }
+        registry().emplace_back(name);
+        return registry().back();
+    }
+    template<typename F>
+    static void forEach(F f) {
+        lock_guard<mutex> lock(registryMutex());
+        for (auto& c : registry()) f(c);
+    }
+    static void resetAll() {
+        forEach([](LockClassStats& c) { c.reset(); });
+    }
+};
+
+class ProfiledMutex {
+private:
+    mutex m;
+    LockClassStats& stats;
+    thread::id lastOwner;
+public:
+    ProfiledMutex(const string& lockClass) : stats(LockProfiler::lockClass(lockClass)) {}
+
+    void lock() {
+        if (!m.try_lock()) {
+            auto start = chrono::steady_clock::now();
+            m.lock();
+            stats.contended.fetch_add(1, memory_order_relaxed);
+            stats.waitNs.fetch_add(chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - start).count(), memory_order_relaxed);
+        }
+        stats.acquisitions.fetch_add(1, memory_order_relaxed);
+        thread::id self = this_thread::get_id();
+        if (lastOwner != self) {
+            if (lastOwner != thread::id()) stats.migrations.fetch_add(1, memory_order_relaxed);
+            lastOwner = self;
+        }
+    }
+    bool try_lock() {
+        if (!m.try_lock()) return false;
+        stats.acquisitions.fetch_add(1, memory_order_relaxed);
+        lastOwner = this_thread::get_id();
+        return true;
+    }
+    void unlock() { m.unlock(); }
+};
+
+// ========================= OPERATION TRACE RECORDING =========================
+// Compact binary trace of FileSystem traffic. Each thread appends encoded
+// records to its own buffer without locking; only full buffers take the file
+// lock. Layout: "FSTRACE1" header, then blocks of
+//   varint client, varint count, varint baseNs,
+//   count x { u8 op|flags, u64 nameHash (LE), varint size, varint deltaNs }
+// Varint and delta encoding keep a typical record at 11-14 bytes.
+enum class TraceOp : uint8_t { Create = 1, Read = 2, Write = 3, Delete = 4 };
+
+struct TraceRecord {
+    TraceOp op;
+    bool failed;
+    uint32_t client;
+    uint64_t nameHash;
+    uint64_t size;
+    uint64_t timestampNs;   // since the recording started
+};
+
+inline uint64_t fnv1a64(const string& s) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+class TraceRecorder {
+private:
+    static constexpr const char* MAGIC = "FSTRACE1";
+    static constexpr size_t FLUSH_BYTES = 64 * 1024;
+    static constexpr uint8_t FAILED_FLAG = 0x80;
+
+    struct ThreadBuffer {
+        uint32_t client;
+        vector<uint8_t> bytes;
+        uint64_t count = 0;       // records in `bytes`
+        uint64_t total = 0;       // records ever, for records()
+        uint64_t baseNs = 0;
+        uint64_t lastNs = 0;
+    };
+
+    uint64_t id;
+    ofstream out;
+    uint64_t startNs;
+    atomic<uint64_t> stampNs{0};   // last timestamp handed out
+    ProfiledMutex fileMutex{"trace.flush"};
+    vector<unique_ptr<ThreadBuffer>> buffers;
+    unordered_map<thread::id, ThreadBuffer*> threadBuffers;   // guarded by fileMutex
+
+    static uint64_t nextId() {
+        static atomic<uint64_t> counter{1};
+        return counter++;
+    }
+    static void putVarint(vector<uint8_t>& buf, uint64_t v) {
+        while (v >= 0x80) {
+            buf.push_back(static_cast<uint8_t>(v | 0x80));
+            v >>= 7;
+        }
+        buf.push_back(static_cast<uint8_t>(v));
+    }
+    static uint8_t* putVarint(uint8_t* p, uint64_t v) {
+        while (v >= 0x80) {
+            *p++ = static_cast<uint8_t>(v | 0x80);
+            v >>= 7;
+        }
+        *p++ = static_cast<uint8_t>(v);
+        return p;
+    }
+    ThreadBuffer& localBuffer() {
+        // The thread caches the buffer of the recorder it used last; the
+        // recorder's own map keeps one buffer (and client id) per thread
+        // when several recorders share a thread.
+        thread_local uint64_t ownerId = 0;
+        thread_local ThreadBuffer* local = nullptr;
+        if (ownerId != id) {
+            lock_guard<ProfiledMutex> lock(fileMutex);
+            ThreadBuffer*& buf = threadBuffers[this_thread::get_id()];
+            if (!buf) {
+                buffers.push_back(make_unique<ThreadBuffer>());
+                buf = buffers.back().get();
+                buf->client = static_cast<uint32_t>(buffers.size() - 1);
+                buf->bytes.reserve(FLUSH_BYTES + 64);
+            }
+            local = buf;
+            ownerId = id;
+        }
+        return *local;
+    }
+    // Caller holds fileMutex
+    void flushLocked(ThreadBuffer& buf) {
+        if (buf.count == 0) return;
+        vector<uint8_t> header;
+        putVarint(header, buf.client);
+        putVarint(header, buf.count);
+        putVarint(header, buf.baseNs);
+        out.write(reinterpret_cast<const char*>(header.data()), header.size());
+        out.write(reinterpret_cast<const char*>(buf.bytes.data()), buf.bytes.size());
+        buf.bytes.clear();
+        buf.count = 0;
+    }
+public:
+    TraceRecorder(const string& path)
+        : id(nextId()), out(path, ios::binary | ios::trunc), startNs(CoarseClock::monotonicNs()) {
+        out.write(MAGIC, 8);
+    }
+    ~TraceRecorder() { close(); }
+
+    bool ok() const { return static_cast<bool>(out); }
+    // Recording threads must be quiescent, as for close()
+    uint64_t records() {
+        lock_guard<ProfiledMutex> lock(fileMutex);
+        uint64_t n = 0;
+        for (auto& buf : buffers) n += buf->total;
+        return n;
+    }
+
+    void record(TraceOp op, const string& name, uint64_t size, bool failed = false) {
+        // Coarse ticks keep the clock read cheap; moving each stamp past the
+        // previous one keeps records in the order the caller's lock let
+        // them through, which replay relies on for shared files
+        uint64_t now = CoarseClock::monotonicNs() - startNs;
+        uint64_t prev = stampNs.load(memory_order_relaxed);
+        while (!stampNs.compare_exchange_weak(prev, max(now, prev + 1), memory_order_relaxed)) {}
+        now = max(now, prev + 1);
+        ThreadBuffer& buf = localBuffer();
+        if (buf.count == 0) buf.baseNs = buf.lastNs = now;
+        // Encoded on the stack and appended at once: 1 + 8 + two varints
+        uint8_t record[1 + 8 + 10 + 10];
+        uint8_t* p = record;
+        *p++ = static_cast<uint8_t>(op) | (failed ? FAILED_FLAG : 0);
+        uint64_t h = fnv1a64(name);
+        for (int i = 0; i < 8; i++) *p++ = static_cast<uint8_t>(h >> (8 * i));
+        p = putVarint(p, size);
+        p = putVarint(p, now - buf.lastNs);
+        buf.bytes.insert(buf.bytes.end(), record, p);
+        buf.lastNs = now;
+        buf.count++;
+        buf.total++;
+        if (buf.bytes.size() >= FLUSH_BYTES) {
+            lock_guard<ProfiledMutex> lock(fileMutex);
+            flushLocked(buf);
+        }
+    }
+
+    // Flushes every thread's buffer; recording threads must be quiescent.
+    void close() {
+        lock_guard<ProfiledMutex> lock(fileMutex);
+        if (!out.is_open()) return;
+        for (auto& buf : buffers) flushLocked(*buf);
+        out.close();
+    }
+
+    // Decodes a whole trace, merging per-thread blocks back into timestamp order.
+    static bool load(const string& path, vector<TraceRecord>& records) {
+        ifstream in(path, ios::binary);
+        vector<uint8_t> data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        if (data.size() < 8 || string(data.begin(), data.begin() + 8) != MAGIC) return false;
+        size_t pos = 8;
+        auto getVarint = [&](uint64_t& v) {
+            v = 0;
+            for (int shift = 0; pos < data.size() && shift < 64; shift += 7) {
+                uint8_t b = data[pos++];
+                v |= static_cast<uint64_t>(b & 0x7f) << shift;
+                if (!(b & 0x80)) return true;
+            }
+            return false;
+        };
+        records.clear();
+        while (pos < data.size()) {
+            uint64_t client, count, ts;
+            if (!getVarint(client) || !getVarint(count) || !getVarint(ts)) return false;
+            for (uint64_t i = 0; i < count; i++) {
+                if (pos + 9 > data.size()) return false;
+                TraceRecord r;
+                uint8_t opByte = data[pos++];
+                r.op = static_cast<TraceOp>(opByte & ~FAILED_FLAG);
+                r.failed = opByte & FAILED_FLAG;
+                r.client = static_cast<uint32_t>(client);
+                r.nameHash = 0;
+                for (int b = 0; b < 8; b++) r.nameHash |= static_cast<uint64_t>(data[pos++]) << (8 * b);
+                uint64_t delta;
+                if (!getVarint(r.size) || !getVarint(delta)) return false;
+                ts += delta;
+                r.timestampNs = ts;
+                records.push_back(r);
+            }
+        }
+        stable_sort(records.begin(), records.end(),
+                    [](const TraceRecord& a, const TraceRecord& b) { return a.timestampNs < b.timestampNs; });
+        return true;
+    }
+};
+
+// ========================= FILE WATCHING =========================
+enum class WatchEventKind : uint8_t { Create, Write, Delete };
+
+struct WatchEvent {
+    WatchEventKind kind;
+    string name;
+    uint64_t size;
+    uint64_t sequence;   // file-system-wide order of the change
+};
+
+inline const char* watchEventName(WatchEventKind kind) {
+    switch (kind) {
+        case WatchEventKind::Create: return "create";
+        case WatchEventKind::Write: return "write";
+        case WatchEventKind::Delete: return "delete";
+    }
+    return "unknown";
+}
+
+// Bounded single-producer/single-consumer ring of change events for one
+// subscription. FileSystem is the only producer (every mutation holds its
+// lock); one subscriber thread drains it with poll() without touching that
+// lock. Events are staged per operation and made visible together by
+// publish(), so a transaction shows up as one batch. When the ring is full
+// new events are dropped and counted, like inotify's queue overflow.
+class WatchQueue {
+private:
+    string path;
+    bool prefix;
+    vector<WatchEvent> slots;
+    size_t mask;
+    alignas(64) atomic<uint64_t> head{0};   // next slot the consumer reads
+    alignas(64) atomic<uint64_t> tail{0};   // first slot not yet published
+    uint64_t staged = 0;                    // producer-private write position
+    uint64_t knownHead = 0;                 // producer's cached copy of head
+    atomic<uint64_t> dropped{0};
+public:
+    WatchQueue(const string& p, bool isPrefix, size_t capacity) : path(p), prefix(isPrefix) {
+        size_t n = 1;
+        while (n < max<size_t>(capacity, 2)) n <<= 1;
+        slots.resize(n);
+        mask = n - 1;
+    }
+
+    bool matches(const string& name) const {
+        return prefix ? name.compare(0, path.size(), path) == 0 : name == path;
+    }
+    const string& watchedPath() const { return path; }
+    bool isPrefix() const { return prefix; }
+
+    // Producer side; slot strings keep their capacity between laps
+    void stage(WatchEventKind kind, const string& name, uint64_t size, uint64_t sequence) {
+        if (staged - knownHead > mask) {
+            knownHead = head.load(memory_order_acquire);
+            if (staged - knownHead > mask) {
+                dropped.fetch_add(1, memory_order_relaxed);
+                return;
+            }
+        }
+        WatchEvent& slot = slots[staged & mask];
+        slot.kind = kind;
+        slot.name.assign(name);
+        slot.size = size;
+        slot.sequence = sequence;
+        staged++;
+    }
+    void publish() {
+        if (staged != tail.load(memory_order_relaxed)) tail.store(staged, memory_order_release);
+    }
+
+    // Consumer side: appends up to `limit` published events to `out`
+    size_t poll(vector<WatchEvent>& out, size_t limit = SIZE_MAX) {
+        uint64_t h = head.load(memory_order_relaxed);
+        uint64_t n = min<uint64_t>(tail.load(memory_order_acquire) - h, limit);
+        for (uint64_t i = 0; i < n; i++) out.push_back(slots[(h + i) & mask]);
+        head.store(h + n, memory_order_release);
+        return n;
+    }
+    uint64_t droppedEvents() const { return dropped.load(memory_order_relaxed); }
+};
+
+// ========================= FILE SYSTEM IMPLEMENTATION =========================
+// Every operation reports an FsStatus; content travels through a caller
+// buffer or an FsResult, never through the error channel.
+enum class FsStatus { Ok, NotFound, AlreadyExists, NoSpace, IoError };
+
+inline const char* statusMessage(FsStatus status) {
+    switch (status) {
+        case FsStatus::Ok: return "ok";
+        case FsStatus::NotFound: return "file not found";
+        case FsStatus::AlreadyExists: return "file already exists";
+        case FsStatus::NoSpace: return "no space left";
+        case FsStatus::IoError: return "I/O error";
+    }
+    return "unknown status";
+}
+
+// Expected-style value-or-status. value() on a failed result is empty.
+template<typename T>
+class FsResult {
+private:
+    FsStatus code;
+    T result;
+public:
+    FsResult(FsStatus s) : code(s), result() {}
+    FsResult(T v) : code(FsStatus::Ok), result(move(v)) {}
+    bool ok() const { return code == FsStatus::Ok; }
+    explicit operator bool() const { return ok(); }
+    FsStatus status() const { return code; }
+    const T& value() const { return result; }
+    T& value() { return result; }
+};
+
+// File content is an immutable buffer shared with the caches, so one write
+// stores one copy of the data; writing swaps in a new buffer.
+using Content = shared_ptr<const string>;
+
+// Timestamps are CoarseClock milliseconds. ctime follows POSIX: it moves on
+// any change to the content or the name.
+struct FileMetadata {
+    uint64_t size = 0;
+    uint64_t ctimeMs = 0;
+    uint64_t mtimeMs = 0;
+    uint64_t atimeMs = 0;
+    uint64_t version = 0;   // bumped by every write
+};
+
+// Access hints for FileSystem::advise(), after madvise/fadvise. WillNeed and
+// DontNeed act once; the others describe how the file will be read and
+// stick to it until replaced.
+enum class Advice { Normal, WillNeed, DontNeed, Sequential, Random, NoReuse };
+
+// Per-call cache admission for readFile(): Bypass serves a miss without
+// inserting the file, so one-off bulk reads leave the working set alone.
+enum class CacheMode { Default, Bypass };
+
+// Classic answers reads from the LRU only (the LFU shadows it at full size);
+// Adaptive splits the capacity between the two and moves it towards
+// whichever policy the sampled ghosts say is hitting more
+enum class CachePolicy { Classic, Adaptive };
+
+// None never updates atime; Relative updates it only when the previous
+// access predates the last modification or is a day old (Linux relatime),
+// so most reads leave the metadata untouched; Strict updates it on every read.
+enum class AtimePolicy { None, Relative, Strict };
+
+class File {
+private:
+    string name;
+    Content content;
+    FileMetadata meta;
+    CachePriority priority = CachePriority::Normal;
+    bool pinned = false;
+    Advice pattern = Advice::Normal;
+
+    void modified() {
+        meta.size = content->size();
+        meta.mtimeMs = meta.ctimeMs = CoarseClock::nowMs();
+        meta.version++;
+    }
+public:
+    static constexpr uint64_t RELATIME_INTERVAL_MS = 24 * 3600 * 1000;
+
+    File(const string& n, string c = "") : name(n), content(make_shared<const string>(move(c))) {
+        modified();
+        meta.atimeMs = meta.mtimeMs;
+    }
+    string read() const { return *content; }
+    const string& data() const { return *content; }
+    const Content& contents() const { return content; }
+    const FileMetadata& metadata() const { return meta; }
+    CachePriority cachePriority() const { return priority; }
+    void setCachePriority(CachePriority p) { priority = p; }
+    bool isPinned() const { return pinned; }
+    void setPinned(bool on) { pinned = on; }
+    Advice accessPattern() const { return pattern; }
+    void setAccessPattern(Advice a) { pattern = a; }
+    void rename(const string& n) {
+        name = n;
+        meta.ctimeMs = CoarseClock::nowMs();
+    }
+    void write(const string& c) {
+        content = make_shared<const string>(c);
+        modified();
+    }
+    void write(string&& c) {
+        content = make_shared<const string>(move(c));
+        modified();
+    }
+    void accessed(AtimePolicy policy) {
+        if (policy == AtimePolicy::None) return;
+        uint64_t now = CoarseClock::nowMs();
+        if (policy == AtimePolicy::Strict || meta.atimeMs <= meta.mtimeMs || now - meta.atimeMs >= RELATIME_INTERVAL_MS) {
+            meta.atimeMs = now;
+        }
+    }
+};
+
+// What the caches hold for a file: its content plus the File itself, so a
+// hit can update atime without a second directory probe. Delete and rename
+// drop the entry under the same lock that frees or moves the File, so the
+// pointer never outlives it.
+struct CachedFile {
+    Content data;
+    File* file = nullptr;
+};
+
+class Directory {
+private:
+    string name;
+    unordered_map<string, shared_ptr<File>> files;
+public:
+    Directory(const string& n) : name(n) {}
+    // Returns the new file, or nullptr if the name is taken
+    shared_ptr<File> createFile(const string& fname, const string& content) {
+        return createFile(fname, string(content));
+    }
+    shared_ptr<File> createFile(const string& fname, string&& content) {
+        if (files.count(fname)) return nullptr;
+        auto file = make_shared<File>(fname, move(content));
+        files[fname] = file;
+        return file;
+    }
+    shared_ptr<File> getFile(const string& fname) {
+        return files.count(fname) ? files[fname] : nullptr;
+    }
+    bool deleteFile(const string& fname) {
+        return files.erase(fname) > 0;
+    }
+    bool renameFile(const string& from, const string& to) {
+        if (files.count(to)) return false;
+        auto entry = files.extract(from);
+        if (entry.empty()) return false;
+        entry.key() = to;
+        entry.mapped()->rename(to);
+        files.insert(move(entry));
+        return true;
+    }
+    template<typename F>
+    void forEachFile(F&& f) const {
+        for (const auto& pair : files) f(pair.first, *pair.second);
+    }
+    void listFiles() const {
+        cout << "Files in " << name << ":" << endl;
+        for(const auto& pair : files) {
+            cout << "- " << pair.first << endl;
+        }
+    }
+};
+
+// A batch of operations applied atomically by FileSystem::commit(): either
+// every operation succeeds or none is applied.
+class Transaction {
+public:
+    enum class Kind { Create, Write, Delete, Rename };
+    struct Op {
+        Kind kind;
+        string name;
+        string target;    // Rename destination
+        string content;   // Create/Write payload
+    };
+private:
+    vector<Op> operations;
+public:
+    Transaction& create(const string& name, string content = "") {
+        operations.push_back({Kind::Create, name, "", move(content)});
+        return *this;
+    }
+    Transaction& write(const string& name, string content) {
+        operations.push_back({Kind::Write, name, "", move(content)});
+        return *this;
+    }
+    Transaction& remove(const string& name) {
+        operations.push_back({Kind::Delete, name, "", ""});
+        return *this;
+    }
+    Transaction& rename(const string& from, const string& to) {
+        operations.push_back({Kind::Rename, from, to, ""});
+        return *this;
+    }
+    size_t size() const { return operations.size(); }
+    vector<Op>& ops() { return operations; }
+};
+
+// Which cache a partition evicts with
+enum class EvictionPolicy { Lru, Lfu };
+
+inline const char* evictionPolicyName(EvictionPolicy policy) {
+    return policy == EvictionPolicy::Lfu ? "lfu" : "lru";
+}
+
+// A slice of the cache for one namespace: every name starting with `prefix`
+// (the longest matching prefix wins) is cached here and nowhere else. A hard
+// quota is a fixed capacity; a soft one is a guaranteed minimum that may grow
+// into slots the shared cache leaves idle and shrinks back when it needs them.
+// Only the cache named by `policy` is given capacity.
+struct CachePartition {
+    string name;
+    string prefix;
+    size_t quota;
+    bool hard;
+    EvictionPolicy policy;
+    LRUCache<string, CachedFile> lru{0};
+    LFUCache<string, CachedFile> lfu{0};
+    uint64_t reads = 0, hits = 0;
+    // Hit ratio at 1/16, 2/16, ... of all partition quotas combined, the
+    // sizes a utility-based reallocation chooses between
+    MissRatioEstimator curve;
+    static constexpr int CURVE_POINTS = 16;
+
+    CachePartition(string n, string pre, size_t q, bool h, EvictionPolicy p, size_t budget)
+        : name(move(n)), prefix(move(pre)), quota(q), hard(h), policy(p), curve(budget, 0.0, curvePoints()) {
+        setCapacity(q);
+    }
+    static vector<double> curvePoints() {
+        vector<double> points;
+        for (int i = 1; i <= CURVE_POINTS; i++) points.push_back(static_cast<double>(i) / CURVE_POINTS);
+        return points;
+    }
+    bool owns(const string& key) const { return key.compare(0, prefix.size(), prefix) == 0; }
+    size_t size() const { return policy == EvictionPolicy::Lfu ? lfu.size() : lru.size(); }
+    size_t capacity() const { return policy == EvictionPolicy::Lfu ? lfu.getCapacity() : lru.getCapacity(); }
+    bool contains(const string& key) const { return lru.contains(key) || lfu.contains(key); }
+    void setCapacity(size_t n) {
+        if (policy == EvictionPolicy::Lfu) lfu.resize(n);
+        else lru.resize(n);
+    }
+};
+
+struct PartitionStats {
+    string name;
+    string prefix;
+    size_t quota = 0;
+    bool hard = false;
+    EvictionPolicy policy = EvictionPolicy::Lru;
+    size_t entries = 0;
+    size_t capacity = 0;    // current limit; above the quota while a soft partition borrows
+    uint64_t reads = 0;
+    uint64_t hits = 0;
+    uint64_t sampledReads = 0;      // reads behind the curve since it last restarted
+    vector<MrcPoint> missRatioCurve;
+    double hitRatio() const { return reads ? static_cast<double>(hits) / reads : 0.0; }
+};
+
+struct CacheStats {
+    uint64_t reads = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t expired = 0;   // entries dropped by the proactive TTL sweep
+    uint64_t prefetched = 0;
+    uint64_t bypassed = 0;  // misses served without cache admission
+    size_t capacity = 0;
+    size_t entries = 0;     // LRU entries; above capacity while a shrink is in progress
+    double samplingRate = 0.0;
+    uint64_t sampledAccesses = 0;
+    vector<MrcPoint> missRatioCurve;
+    bool adaptive = false;
+    size_t lruShare = 0, lfuShare = 0;   // entries each policy may hold
+    uint64_t lfuHits = 0;                // hits answered by the LFU segment
+    uint64_t policyShifts = 0;
+    double ghostLruHitRatio = 0.0, ghostLfuHitRatio = 0.0;
+    vector<PartitionStats> partitions;
+    double hitRatio() const { return reads ? static_cast<double>(hits) / reads : 0.0; }
+};
+
+class FileSystem {
+private:
+    shared_ptr<Directory> root;
+    size_t cacheCapacity;
+    LRUCache<string, CachedFile> lruCache;
+    LFUCache<string, CachedFile> lfuCache;
+    MissRatioEstimator mrc;
+    uint64_t readCount = 0, hitCount = 0, missCount = 0;
+    unique_ptr<TraceRecorder> recorder;
+    bool verbose = true;
+    PhaseProfile phases;
+    // One lock serializes every operation; it also orders recorded traces
+    mutable ProfiledMutex fsMutex{"filesystem"};
+
+    vector<shared_ptr<WatchQueue>> watchers;
+    // Exact names are looked up, so a change costs one probe however many
+    // files are watched; only prefix watches are scanned
+    unordered_map<string, vector<WatchQueue*>> nameWatchers;
+    vector<WatchQueue*> prefixWatchers;
+    vector<WatchQueue*> unpublished;   // staged by a transaction, published at its end
+    uint64_t watchSequence = 0;
+    AtimePolicy atimePolicy = AtimePolicy::Relative;
+    uint64_t cacheTtlMs = 0;
+    size_t admissionLimit = 0;   // bytes; larger files are never cached (0 = no limit)
+    uint64_t expiredCount = 0, prefetchCount = 0, bypassCount = 0;
+    vector<string> expiredNames;   // scratch for maintainCaches
+    // WillNeed prefetches run on a background thread started on first use
+    deque<string> prefetchQueue;
+    mutex prefetchMutex;
+    condition_variable prefetchReady;
+    bool prefetchStopping = false;
+    thread prefetcher;
+    static constexpr size_t EXPIRE_BATCH = 32;
+    static constexpr size_t SHRINK_BATCH = 64;
+    CachePolicy policy = CachePolicy::Classic;
+    PolicyArbiter arbiter;
+    size_t lruShare = 0;
+    uint64_t lfuHitCount = 0, policyShiftCount = 0;
+    uint64_t lfuAgingPeriod = 0;           // last setLfuAging, for new partitions
+    int lfuMaxFrequency = INT_MAX;
+    vector<unique_ptr<CachePartition>> partitions;
+
+    void trace(TraceOp op, const string& name, uint64_t size, bool failed = false) {
+        if (recorder) recorder->record(op, name, size, failed);
+    }
+    // Writers pay one branch when nobody watches
+    void notify(WatchEventKind kind, const string& name, uint64_t size, bool publish = true) {
+        if (watchers.empty()) return;
+        watchSequence++;
+        auto deliver = [&](WatchQueue* w) {
+            w->stage(kind, name, size, watchSequence);
+            if (publish) w->publish();
+            else unpublished.push_back(w);
+        };
+        auto it = nameWatchers.find(name);
+        if (it != nameWatchers.end()) {
+            for (WatchQueue* w : it->second) deliver(w);
+        }
+        for (WatchQueue* w : prefixWatchers) {
+            if (w->matches(name)) deliver(w);
+        }
+    }
+    void publishEvents() {
+        for (WatchQueue* w : unpublished) w->publish();
+        unpublished.clear();
+    }
+    // Puts the file into both caches with its priority and pin state; false
+    // if it is not admitted (any stale copy is dropped) or the LRU had no
+    // room because every entry is pinned. Sequentially read files are cached
+    // at low priority so they are dropped behind. A prefetch is an explicit
+    // request and admits NoReuse files too.
+    bool cacheFile(const string& name, File& file, bool prefetch = false) {
+        CachePartition* part = partitionFor(name);
+        if (!admit(file, prefetch)) {
+            uncache(part, name);
+            return false;
+        }
+        makeRoom(part, name);
+        CachePriority priority = priorityOf(file);
+        CachedFile entry{file.contents(), &file};
+        bool stored = lruOf(part).put(name, entry, ttlOf(file), priority);
+        bool lfuStored = lfuOf(part).put(name, move(entry), ttlOf(file), priority);
+        if (!stored && !lfuStored) {
+            uncache(part, name);   // no cache may keep an older copy
+            return false;
+        }
+        if (part || policy == CachePolicy::Adaptive) stored = stored || lfuStored;
+        if (stored && file.isPinned()) {
+            lruOf(part).pin(name);
+            lfuOf(part).pin(name);
+        }
+        return stored;
+    }
+    void uncache(CachePartition* part, const string& name) {
+        lruOf(part).remove(name);
+        lfuOf(part).remove(name);
+    }
+    // Partition owning `name`, or nullptr for the shared caches; a linear
+    // scan, since there are only ever a handful
+    CachePartition* partitionFor(const string& name) const {
+        CachePartition* match = nullptr;
+        for (auto& p : partitions) {
+            if (p->owns(name) && (!match || p->prefix.size() > match->prefix.size())) match = p.get();
+        }
+        return match;
+    }
+    LRUCache<string, CachedFile>& lruOf(CachePartition* part) { return part ? part->lru : lruCache; }
+    LFUCache<string, CachedFile>& lfuOf(CachePartition* part) { return part ? part->lfu : lfuCache; }
+    size_t reservedCapacity() const {
+        size_t reserved = 0;
+        for (auto& p : partitions) reserved += p->quota;
+        return reserved;
+    }
+    size_t sharedCapacity() const {
+        size_t reserved = reservedCapacity();
+        return cacheCapacity > reserved ? cacheCapacity - reserved : 0;
+    }
+    // Slots held by the shared caches; in adaptive mode an entry in both
+    // segments counts twice, as it uses budget in both
+    size_t sharedUsage() const {
+        return policy == CachePolicy::Adaptive ? lruCache.size() + lfuCache.size() : lruCache.size();
+    }
+    size_t borrowedSlots() const {
+        size_t borrowed = 0;
+        for (auto& p : partitions) {
+            if (!p->hard && p->size() > p->quota) borrowed += p->size() - p->quota;
+        }
+        return borrowed;
+    }
+    // Before `name` is cached: a soft partition at its quota takes one idle
+    // shared slot if there is one, otherwise evicts its own entries; a new
+    // shared entry with no idle slot left reclaims one from a borrower
+    void makeRoom(CachePartition* part, const string& name) {
+        if (part && part->hard) return;
+        bool idle = sharedUsage() + borrowedSlots() < sharedCapacity();
+        if (part) {
+            if (part->contains(name)) return;
+            size_t used = part->size();
+            part->setCapacity(max(part->quota, idle ? used + 1 : used));
+            return;
+        }
+        if (idle || lruCache.contains(name) || lfuCache.contains(name)) return;
+        for (auto& p : partitions) {
+            if (p->hard || p->size() <= p->quota) continue;
+            p->setCapacity(p->size() - 1);
+            p->lru.shrink(1);
+            p->lfu.shrink(1);
+            return;
+        }
+    }
+    // After quotas change: the shared caches get the remainder and every
+    // partition curve is rescaled to the new combined quota
+    void applyPartitionBudget() {
+        applyBudget();
+        arbiter.resize(sharedCapacity());
+        for (auto& p : partitions) p->curve.resize(reservedCapacity());
+    }
+    // After partitions change, drops every cached entry that now belongs to
+    // another segment so no copy outlives a later write, rebudgets, and
+    // caches the pinned ones again where they now belong. `gone` is a
+    // partition just taken out, whose entries all move.
+    void rehomeEntries(CachePartition* gone = nullptr) {
+        vector<string> pinned;
+        auto misplaced = [this, &pinned](CachePartition* part) {
+            return [this, part, &pinned](const string& key) {
+                if (partitionFor(key) == part) return false;
+                auto file = root->getFile(key);
+                if (file && file->isPinned()) pinned.push_back(key);
+                return true;
+            };
+        };
+        lruCache.removeIf(misplaced(nullptr));
+        lfuCache.removeIf(misplaced(nullptr));
+        for (auto& p : partitions) {
+            p->lru.removeIf(misplaced(p.get()));
+            p->lfu.removeIf(misplaced(p.get()));
+        }
+        if (gone) {
+            gone->lru.removeIf(misplaced(gone));
+            gone->lfu.removeIf(misplaced(gone));
+        }
+        applyPartitionBudget();
+        sort(pinned.begin(), pinned.end());
+        pinned.erase(unique(pinned.begin(), pinned.end()), pinned.end());
+        for (const string& key : pinned) cacheFile(key, *root->getFile(key));
+    }
+    // Pinned files per owning segment (nullptr for the shared caches)
+    map<CachePartition*, size_t> pinnedPerSegment() const {
+        map<CachePartition*, size_t> counts;
+        root->forEachFile([&](const string& name, const File& file) {
+            if (file.isPinned()) counts[partitionFor(name)]++;
+        });
+        return counts;
+    }
+    // Whether the pinned files fit the segments that take them in after a
+    // partition change: `part` its quota, the shared caches their capacity
+    // (or what they already held over it)
+    bool pinnedFit(CachePartition* part, size_t sharedPinnedBefore) const {
+        auto counts = pinnedPerSegment();
+        if (part && counts[part] > part->quota) return false;
+        return counts[nullptr] <= max(sharedCapacity(), sharedPinnedBefore);
+    }
+    // Feeds the miss-ratio estimators and, in adaptive mode, the arbiter; a
+    // verdict moves one step of capacity to the winning policy
+    void sampleAccess(const string& name, bool isRead) { sampleAccess(partitionFor(name), name, isRead); }
+    void sampleAccess(CachePartition* part, const string& name, bool isRead) {
+        mrc.access(name, isRead);
+        if (part) {
+            part->curve.access(name, isRead);
+            return;
+        }
+        if (policy != CachePolicy::Adaptive) return;
+        auto verdict = arbiter.access(name, isRead);
+        if (verdict == PolicyArbiter::Verdict::Hold) return;
+        size_t shared = sharedCapacity();
+        size_t step = max<size_t>(1, shared / 16);
+        size_t floor = shared / 16;
+        size_t share = lruShare;
+        if (verdict == PolicyArbiter::Verdict::FavorLru) {
+            share = min(shared - floor, share + step);
+        } else {
+            share = share > floor + step ? share - step : floor;
+        }
+        if (share == lruShare) return;
+        lruShare = share;
+        policyShiftCount++;
+        applyBudget();
+        if (verbose) cout << " -> Cache budget now LRU " << lruShare << ", LFU " << shared - lruShare << endl;
+    }
+    // Sizes the shared caches for the current policy from what partition
+    // quotas leave; excess entries go in SHRINK_BATCH steps through
+    // maintainCaches()
+    void applyBudget() {
+        size_t shared = sharedCapacity();
+        lruShare = min(lruShare, shared);
+        bool adaptive = policy == CachePolicy::Adaptive;
+        lruCache.resize(adaptive ? lruShare : shared);
+        lfuCache.resize(adaptive ? shared - lruShare : shared);
+    }
+    static CachePriority priorityOf(const File& file) {
+        return file.accessPattern() == Advice::Sequential ? CachePriority::Low : file.cachePriority();
+    }
+    // The default TTL would expire pinned files, so they go without it
+    uint64_t ttlOf(const File& file) const { return file.isPinned() ? 0 : cacheTtlMs; }
+    // Whether the file may occupy cache space
+    bool admit(const File& file, bool prefetch = false) const {
+        if (file.isPinned()) return true;
+        if (file.accessPattern() == Advice::NoReuse && !prefetch) return false;
+        return !admissionLimit || file.data().size() <= admissionLimit;
+    }
+    void prefetchLoop() {
+        unique_lock<mutex> queueLock(prefetchMutex);
+        while (true) {
+            prefetchReady.wait(queueLock, [this] { return prefetchStopping || !prefetchQueue.empty(); });
+            if (prefetchStopping) return;
+            string name = move(prefetchQueue.front());
+            prefetchQueue.pop_front();
+            queueLock.unlock();
+            {
+                lock_guard<ProfiledMutex> lock(fsMutex);
+                if (auto file = root->getFile(name)) {
+                    if (cacheFile(name, *file, true)) prefetchCount++;
+                }
+            }
+            queueLock.lock();
+        }
+    }
+    // TTL expiry and shrinking after a resize are bounded per operation, so
+    // a burst of either is spread over several operations
+    void maintainCaches() {
+        // The shared LRU and LFU may both hold a name; it counts as expired
+        // once, when the last copy goes
+        expiredNames.clear();
+        lruCache.expire(EXPIRE_BATCH, &expiredNames);
+        lfuCache.expire(EXPIRE_BATCH, &expiredNames);
+        if (!expiredNames.empty()) {
+            sort(expiredNames.begin(), expiredNames.end());
+            expiredNames.erase(unique(expiredNames.begin(), expiredNames.end()), expiredNames.end());
+            for (const string& name : expiredNames) {
+                expiredCount += !lruCache.contains(name) && !lfuCache.contains(name);
+            }
+        }
+        lruCache.shrink(SHRINK_BATCH);
+        lfuCache.shrink(SHRINK_BATCH);
+        for (auto& p : partitions) {
+            expiredCount += p->lru.expire(EXPIRE_BATCH) + p->lfu.expire(EXPIRE_BATCH);
+            p->lru.shrink(SHRINK_BATCH);
+            p->lfu.shrink(SHRINK_BATCH);
+        }
+    }
+public:
+    FileSystem(size_t cacheSize = 10)
+        : cacheCapacity(cacheSize), lruCache(cacheSize), lfuCache(cacheSize), mrc(cacheSize),
+          arbiter(cacheSize) {
+        root = make_shared<Directory>("root");
+    }
+
+    ~FileSystem() {
+        {
+            lock_guard<mutex> lock(prefetchMutex);
+            prefetchStopping = true;
+        }
+        prefetchReady.notify_all();
+        if (prefetcher.joinable()) prefetcher.join();
+    }
+
+    // Per-operation logging; benchmarks and replays turn it off
+    void setVerbose(bool on) { verbose = on; }
+
+    // Times the phases of one read in every n (0 turns sampling off)
+    void setPhaseSampling(uint32_t n) { phases.setSampleEvery(n); }
+    void printPhaseProfile() const { phases.print(); }
+
+    // A cache hit costs one directory probe for atime unless the policy is None
+    void setAtimePolicy(AtimePolicy policy) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        atimePolicy = policy;
+    }
+
+    // CREATE operation (File Allocation)
+    FsStatus createFile(const string& name, const string& content = "") {
+        return createFile(name, string(content));
+    }
+
+    // Takes ownership of `content`; it is only consumed on success
+    FsStatus createFile(const string& name, string&& content) {
+        ALLOC_SCOPE("fs.create");
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        maintainCaches();
+        if (verbose) cout << "Attempting to CREATE '" << name << "'..." << endl;
+        size_t size = content.size();
+        if (auto file = root->createFile(name, move(content))) {
+            cacheFile(name, *file);
+            sampleAccess(name, false);
+            trace(TraceOp::Create, name, size);
+            notify(WatchEventKind::Create, name, size);
+            if (verbose) cout << " -> Success." << endl;
+            return FsStatus::Ok;
+        }
+        trace(TraceOp::Create, name, size, true);
+        if (verbose) cout << " -> Failure (file already exists)." << endl;
+        return FsStatus::AlreadyExists;
+    }
+
+    // READ operation, returning a copy of the content
+    FsResult<string> readFile(const string& name) {
+        ALLOC_SCOPE("fs.read.copy");
+        string content;
+        FsStatus status = readFile(name, content);
+        if (status != FsStatus::Ok) return status;
+        return FsResult<string>(move(content));
+    }
+
+    // READ into a caller-owned buffer; a cache hit reuses its storage and
+    // does not allocate once the buffer is large enough. `out` is left
+    // untouched on failure.
+    FsStatus readFile(const string& name, string& out, CacheMode mode = CacheMode::Default) {
+        ALLOC_SCOPE("fs.read");
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        maintainCaches();
+        if (verbose) cout << "Attempting to READ '" << name << "'..." << endl;
+        readCount++;
+        PhaseTimer sample(phases);
+        PhaseTimer* timer = sample.get();
+        CachePartition* part = partitionFor(name);
+        if (part) part->reads++;
+        if (const CachedFile* cached = lruOf(part).lookup(name, timer)) {
+            out = *cached->data;
+            if (timer) timer->mark(ReadPhase::Copy);
+            hitCount++;
+            if (part) part->hits++;
+            sampleAccess(part, name, true);
+            if (verbose) cout << " -> Success (from LRU Cache)." << endl;
+            lfuOf(part).touch(name); // Update LFU frequency
+            cached->file->accessed(atimePolicy);
+            trace(TraceOp::Read, name, out.size());
+            if (timer) timer->mark(ReadPhase::Accounting);
+            return FsStatus::Ok;
+        }
+        if (part ? part->policy == EvictionPolicy::Lfu : policy == CachePolicy::Adaptive) {
+            if (const CachedFile* cached = lfuOf(part).lookup(name)) {
+                out = *cached->data;
+                hitCount++;
+                if (part) part->hits++;
+                else lfuHitCount++;
+                sampleAccess(part, name, true);
+                if (verbose) cout << " -> Success (from LFU Cache)." << endl;
+                // Keep the LRU segment's recency order complete
+                File* file = cached->file;
+                file->accessed(atimePolicy);
+                if (lruOf(part).put(name, *cached, ttlOf(*file), priorityOf(*file)) && file->isPinned()) {
+                    lruOf(part).pin(name);
+                }
+                trace(TraceOp::Read, name, out.size());
+                return FsStatus::Ok;
+            }
+        }
+        missCount++;
+        auto file = root->getFile(name);
+        if (file) {
+            sampleAccess(part, name, true);
+            if (verbose) cout << " -> Success (from disk)." << endl;
+            out = file->data();
+            file->accessed(atimePolicy);
+            if (timer) timer->mark(ReadPhase::Fetch);
+            if (mode == CacheMode::Bypass || !admit(*file)) bypassCount++;
+            if (mode != CacheMode::Bypass) cacheFile(name, *file);
+            trace(TraceOp::Read, name, out.size());
+            if (timer) timer->mark(ReadPhase::Accounting);
+            return FsStatus::Ok;
+        }
+        mrc.miss(name);
+        if (part) part->curve.miss(name);
+        trace(TraceOp::Read, name, 0, true);
+        if (verbose) cout << " -> Failure (file not found)." << endl;
+        return FsStatus::NotFound;
+    }
+
+    // WRITE operation
+    FsStatus writeFile(const string& name, const string& content) {
+        return writeFile(name, string(content));
+    }
+
+    // Takes ownership of `content`; it is only consumed on success
+    FsStatus writeFile(const string& name, string&& content) {
+        ALLOC_SCOPE("fs.write");
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        maintainCaches();
+        if (verbose) cout << "Attempting to WRITE to '" << name << "'..." << endl;
+        auto file = root->getFile(name);
+        if (file) {
+            size_t size = content.size();
+            file->write(move(content));
+            cacheFile(name, *file); // Update cache
+            sampleAccess(name, false);
+            trace(TraceOp::Write, name, size);
+            notify(WatchEventKind::Write, name, size);
+            if (verbose) cout << " -> Success." << endl;
+            return FsStatus::Ok;
+        }
+        trace(TraceOp::Write, name, content.size(), true);
+        if (verbose) cout << " -> Failure (file not found)." << endl;
+        return FsStatus::NotFound;
+    }
+
+    // DELETE operation (File Deallocation)
+    FsStatus deleteFile(const string& name) {
+        ALLOC_SCOPE("fs.delete");
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        maintainCaches();
+        if (verbose) cout << "Attempting to DELETE '" << name << "'..." << endl;
+        if (root->deleteFile(name)) {
+            uncache(partitionFor(name), name); // Invalidate cache
+            trace(TraceOp::Delete, name, 0);
+            notify(WatchEventKind::Delete, name, 0);
+            if (verbose) cout << " -> Success." << endl;
+            return FsStatus::Ok;
+        }
+        trace(TraceOp::Delete, name, 0, true);
+        if (verbose) cout << " -> Failure (file not found)." << endl;
+        return FsStatus::NotFound;
+    }
+
+    // RENAME operation; fails if the destination exists
+    FsStatus renameFile(const string& from, const string& to) {
+        Transaction tx;
+        tx.rename(from, to);
+        return commit(move(tx));
+    }
+
+    // Applies a transaction under one lock acquisition. Every operation is
+    // validated against the state left by the ones before it, so a failure
+    // leaves the file system untouched and reports the failing index through
+    // `failedOp`. Caches are updated once per touched name at the end.
+    FsStatus commit(Transaction&& tx, size_t* failedOp = nullptr) {
+        ALLOC_SCOPE("fs.commit");
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        maintainCaches();
+        if (verbose) cout << "Attempting to COMMIT " << tx.size() << " operation(s)..." << endl;
+
+        unordered_map<string, bool> staged;   // names created or deleted so far
+        unordered_set<string> touched;
+        auto exists = [&](const string& name) {
+            auto it = staged.find(name);
+            return it != staged.end() ? it->second : root->getFile(name) != nullptr;
+        };
+        for (size_t i = 0; i < tx.size(); i++) {
+            const Transaction::Op& op = tx.ops()[i];
+            FsStatus status = FsStatus::Ok;
+            switch (op.kind) {
+                case Transaction::Kind::Create:
+                    if (exists(op.name)) status = FsStatus::AlreadyExists;
+                    else staged[op.name] = true;
+                    break;
+                case Transaction::Kind::Write:
+                    if (!exists(op.name)) status = FsStatus::NotFound;
+                    break;
+                case Transaction::Kind::Delete:
+                    if (!exists(op.name)) status = FsStatus::NotFound;
+                    else staged[op.name] = false;
+                    break;
+                case Transaction::Kind::Rename:
+                    if (!exists(op.name)) status = FsStatus::NotFound;
+                    else if (exists(op.target)) status = FsStatus::AlreadyExists;
+                    else staged[op.name] = false, staged[op.target] = true;
+                    break;
+            }
+            touched.insert(op.name);
+            if (op.kind == Transaction::Kind::Rename) touched.insert(op.target);
+            if (status != FsStatus::Ok) {
+                if (failedOp) *failedOp = i;
+                if (verbose) cout << " -> Failure (operation " << i << ": " << statusMessage(status) << ")." << endl;
+                return status;
+            }
+        }
+
+        // Renames are traced as delete + create so replays stay single-name
+        for (auto& op : tx.ops()) {
+            size_t size = op.content.size();
+            switch (op.kind) {
+                case Transaction::Kind::Create:
+                    root->createFile(op.name, move(op.content));
+                    trace(TraceOp::Create, op.name, size);
+                    notify(WatchEventKind::Create, op.name, size, false);
+                    break;
+                case Transaction::Kind::Write:
+                    root->getFile(op.name)->write(move(op.content));
+                    trace(TraceOp::Write, op.name, size);
+                    notify(WatchEventKind::Write, op.name, size, false);
+                    break;
+                case Transaction::Kind::Delete:
+                    root->deleteFile(op.name);
+                    trace(TraceOp::Delete, op.name, 0);
+                    notify(WatchEventKind::Delete, op.name, 0, false);
+                    break;
+                case Transaction::Kind::Rename:
+                    root->renameFile(op.name, op.target);
+                    trace(TraceOp::Delete, op.name, 0);
+                    trace(TraceOp::Create, op.target, root->getFile(op.target)->data().size());
+                    notify(WatchEventKind::Delete, op.name, 0, false);
+                    notify(WatchEventKind::Create, op.target, root->getFile(op.target)->data().size(), false);
+                    break;
+            }
+        }
+        publishEvents();
+        for (const auto& name : touched) {
+            if (auto file = root->getFile(name)) {
+                cacheFile(name, *file);
+                sampleAccess(name, false);
+            } else {
+                uncache(partitionFor(name), name);
+            }
+        }
+        if (verbose) cout << " -> Success." << endl;
+        return FsStatus::Ok;
+    }
+
+    // Changes the cache capacity online. Growing is immediate; shrinking
+    // evicts one batch now and another with each following operation.
+    void resizeCache(size_t newCapacity) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        // Partition quotas and the adaptive split keep their ratios
+        auto scale = [&](size_t n) {
+            return cacheCapacity ? static_cast<size_t>(static_cast<double>(n) * newCapacity / cacheCapacity) : 0;
+        };
+        lruShare = cacheCapacity ? scale(lruShare) : newCapacity / 2;
+        for (auto& p : partitions) {
+            p->quota = scale(p->quota);
+            p->setCapacity(p->quota);
+        }
+        cacheCapacity = newCapacity;
+        applyPartitionBudget();
+        mrc.resize(newCapacity);
+        maintainCaches();
+    }
+
+    // Creates or replaces the partition `name` for names starting with
+    // `prefix`. Its quota comes out of the shared capacity; NoSpace if the
+    // quotas would exceed the total or the pinned files it takes over would
+    // not fit it. Cached entries move to the segment that now owns them by
+    // being dropped and refetched; pinned ones are moved at once. The
+    // partition's LFU ages like the others (setLfuAging).
+    FsStatus setPartition(const string& name, const string& prefix, size_t quota, bool hard = true,
+                          EvictionPolicy eviction = EvictionPolicy::Lru) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        auto it = find_if(partitions.begin(), partitions.end(), [&](auto& p) { return p->name == name; });
+        size_t reserved = reservedCapacity() - (it != partitions.end() ? (*it)->quota : 0);
+        if (reserved + quota > cacheCapacity) return FsStatus::NoSpace;
+        auto partition = make_unique<CachePartition>(name, prefix, quota, hard, eviction, reserved + quota);
+        partition->lfu.setAging(lfuAgingPeriod, lfuMaxFrequency);
+        CachePartition* added = partition.get();
+        size_t sharedPinned = pinnedPerSegment()[nullptr];
+        unique_ptr<CachePartition> replaced;
+        if (it != partitions.end()) replaced = move(*it), *it = move(partition);
+        else partitions.push_back(move(partition));
+        if (!pinnedFit(added, sharedPinned)) {
+            if (replaced) *it = move(replaced);
+            else partitions.pop_back();
+            return FsStatus::NoSpace;
+        }
+        rehomeEntries(replaced.get());
+        return FsStatus::Ok;
+    }
+
+    // Returns the partition's names to the shared caches; NoSpace if its
+    // pinned files would not fit there
+    FsStatus removePartition(const string& name) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        auto it = find_if(partitions.begin(), partitions.end(), [&](auto& p) { return p->name == name; });
+        if (it == partitions.end()) return FsStatus::NotFound;
+        size_t sharedPinned = pinnedPerSegment()[nullptr];
+        size_t index = it - partitions.begin();
+        unique_ptr<CachePartition> removed = move(*it);
+        partitions.erase(it);
+        if (!pinnedFit(nullptr, sharedPinned)) {
+            partitions.insert(partitions.begin() + index, move(removed));
+            return FsStatus::NoSpace;
+        }
+        rehomeEntries(removed.get());
+        return FsStatus::Ok;
+    }
+
+    // Moves capacity between partitions without dropping entries; names not
+    // listed keep their quota. NoSpace if the quotas would exceed the total,
+    // NotFound for an unknown partition. Every partition's curve restarts so
+    // the next reallocation is based on traffic under these quotas.
+    FsStatus setPartitionQuotas(const map<string, size_t>& quotas) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        size_t reserved = reservedCapacity();
+        for (const auto& [name, quota] : quotas) {
+            auto it = find_if(partitions.begin(), partitions.end(), [&](auto& p) { return p->name == name; });
+            if (it == partitions.end()) return FsStatus::NotFound;
+            reserved = reserved - (*it)->quota + quota;
+        }
+        if (reserved > cacheCapacity) return FsStatus::NoSpace;
+        for (auto& p : partitions) {
+            auto q = quotas.find(p->name);
+            if (q == quotas.end()) continue;
+            p->quota = q->second;
+            p->setCapacity(p->hard ? p->quota : max(p->quota, p->size()));
+        }
+        applyPartitionBudget();
+        maintainCaches();
+        return FsStatus::Ok;
+    }
+
+    // LFU aging: frequencies capped at `maxFrequency`, halved every `period`
+    // accesses (0 = never), but no more often than once per cache size
+    void setLfuAging(uint64_t period, int maxFrequency = INT_MAX) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        lfuAgingPeriod = period;
+        lfuMaxFrequency = maxFrequency;
+        lfuCache.setAging(period, maxFrequency);
+        for (auto& p : partitions) p->lfu.setAging(period, maxFrequency);
+        arbiter.setAging(period, maxFrequency);
+    }
+
+    // Adaptive starts from an even split; Classic gives the LRU the whole
+    // capacity again. Either way the caches keep their contents.
+    void setCachePolicy(CachePolicy newPolicy) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        if (newPolicy == policy) return;
+        policy = newPolicy;
+        lruShare = sharedCapacity() - sharedCapacity() / 2;
+        applyBudget();
+        maintainCaches();
+    }
+
+    size_t getCacheCapacity() const {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        return cacheCapacity;
+    }
+
+    // Files larger than `bytes` are served and written without occupying
+    // the caches; pinned files are exempt (0 = no limit)
+    void setAdmissionLimit(size_t bytes) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        admissionLimit = bytes;
+    }
+
+    // TTL applied to every entry put into the caches from now on (0 = none);
+    // pinned files are exempt
+    void setCacheTtl(uint64_t ttlMs) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        cacheTtlMs = ttlMs;
+    }
+
+    // Expires one cached file after `ttlMs` until it is next written. This
+    // applies to a pinned file too: an explicit TTL is a request to expire.
+    FsStatus setCacheTtl(const string& name, uint64_t ttlMs) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        CachePartition* part = partitionFor(name);
+        bool cached = lruOf(part).setTtl(name, ttlMs);
+        cached = lfuOf(part).setTtl(name, ttlMs) || cached;
+        return cached ? FsStatus::Ok : FsStatus::NotFound;
+    }
+
+    // Keeps a file cached until unpinned, clearing any TTL; NoSpace if the
+    // cache is full of pinned files. Pins survive writes and renames.
+    FsStatus pin(const string& name) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        auto file = root->getFile(name);
+        if (!file) return FsStatus::NotFound;
+        file->setPinned(true);
+        if (!cacheFile(name, *file)) {
+            file->setPinned(false);
+            return FsStatus::NoSpace;
+        }
+        return FsStatus::Ok;
+    }
+
+    FsStatus unpin(const string& name) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        auto file = root->getFile(name);
+        if (!file) return FsStatus::NotFound;
+        file->setPinned(false);
+        CachePartition* part = partitionFor(name);
+        lruOf(part).unpin(name);
+        lfuOf(part).unpin(name);
+        return FsStatus::Ok;
+    }
+
+    // Low-priority files are evicted before any normal or high one
+    FsStatus setPriority(const string& name, CachePriority priority) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        auto file = root->getFile(name);
+        if (!file) return FsStatus::NotFound;
+        file->setCachePriority(priority);
+        CachePartition* part = partitionFor(name);
+        lruOf(part).setPriority(name, priority);
+        lfuOf(part).setPriority(name, priority);
+        return FsStatus::Ok;
+    }
+
+    // WillNeed queues an asynchronous load into the caches; DontNeed drops
+    // the cached copy now unless pinned. Sequential caches the file at low
+    // priority, NoReuse serves its misses without caching, and Random or
+    // Normal restore the default. The one-shot hints leave the sticky one
+    // alone: WillNeed loads a NoReuse file once, later misses still bypass.
+    FsStatus advise(const string& name, Advice advice) {
+        {
+            lock_guard<ProfiledMutex> lock(fsMutex);
+            auto file = root->getFile(name);
+            if (!file) return FsStatus::NotFound;
+            CachePartition* part = partitionFor(name);
+            switch (advice) {
+                case Advice::WillNeed:
+                    break;
+                case Advice::DontNeed:
+                    if (!file->isPinned()) uncache(part, name);
+                    return FsStatus::Ok;
+                case Advice::Normal:
+                case Advice::Random:
+                    file->setAccessPattern(Advice::Normal);
+                    lruOf(part).setPriority(name, file->cachePriority());
+                    lfuOf(part).setPriority(name, file->cachePriority());
+                    return FsStatus::Ok;
+                case Advice::Sequential:
+                    file->setAccessPattern(advice);
+                    lruOf(part).setPriority(name, CachePriority::Low);
+                    lfuOf(part).setPriority(name, CachePriority::Low);
+                    return FsStatus::Ok;
+                case Advice::NoReuse:
+                    file->setAccessPattern(advice);
+                    cacheFile(name, *file);   // drops the cached copy unless pinned
+                    return FsStatus::Ok;
+            }
+        }
+        lock_guard<mutex> lock(prefetchMutex);
+        if (!prefetcher.joinable()) prefetcher = thread([this] { prefetchLoop(); });
+        prefetchQueue.push_back(name);
+        prefetchReady.notify_one();
+        return FsStatus::Ok;
+    }
+
+    FsResult<FileMetadata> stat(const string& name) const {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        auto file = root->getFile(name);
+        if (!file) return FsStatus::NotFound;
+        return FsResult<FileMetadata>(file->metadata());
+    }
+
+    // Subscribes to changes of one name, or of every name starting with
+    // `path` when `prefix` is set. Drain the returned queue from one thread.
+    shared_ptr<WatchQueue> watch(const string& path, bool prefix = false, size_t capacity = 1024) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        watchers.push_back(make_shared<WatchQueue>(path, prefix, capacity));
+        if (prefix) prefixWatchers.push_back(watchers.back().get());
+        else nameWatchers[path].push_back(watchers.back().get());
+        return watchers.back();
+    }
+
+    void unwatch(const shared_ptr<WatchQueue>& queue) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        auto it = find(watchers.begin(), watchers.end(), queue);
+        if (it == watchers.end()) return;
+        WatchQueue* w = it->get();
+        if (w->isPrefix()) {
+            prefixWatchers.erase(remove(prefixWatchers.begin(), prefixWatchers.end(), w), prefixWatchers.end());
+        } else {
+            auto& list = nameWatchers[w->watchedPath()];
+            list.erase(remove(list.begin(), list.end(), w), list.end());
+            if (list.empty()) nameWatchers.erase(w->watchedPath());
+        }
+        watchers.erase(it);
+    }
+
+    // Operation trace recording (see TraceRecorder for the format)
+    bool startRecording(const string& path) {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        recorder = make_unique<TraceRecorder>(path);
+        if (!recorder->ok()) {
+            recorder.reset();
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t stopRecording() {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        if (!recorder) return 0;
+        uint64_t n = recorder->records();
+        recorder.reset();
+        return n;
+    }
+
+    void listFiles() const {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        root->listFiles();
+    }
+
+    // Hit counters plus the estimated hit ratio at other cache sizes
+    CacheStats getStats() const {
+        lock_guard<ProfiledMutex> lock(fsMutex);
+        CacheStats stats;
+        stats.reads = readCount;
+        stats.hits = hitCount;
+        stats.misses = missCount;
+        stats.expired = expiredCount;
+        stats.prefetched = prefetchCount;
+        stats.bypassed = bypassCount;
+        stats.capacity = cacheCapacity;
+        stats.entries = lruCache.size();
+        stats.samplingRate = mrc.samplingRate();
+        stats.sampledAccesses = mrc.samples();
+        stats.missRatioCurve = mrc.curve();
+        stats.adaptive = policy == CachePolicy::Adaptive;
+        stats.lruShare = lruCache.getCapacity();
+        stats.lfuShare = lfuCache.getCapacity();
+        stats.lfuHits = lfuHitCount;
+        stats.policyShifts = policyShiftCount;
+        stats.ghostLruHitRatio = arbiter.lruHitRatio();
+        stats.ghostLfuHitRatio = arbiter.lfuHitRatio();
+        for (auto& p : partitions) {
+            stats.partitions.push_back({p->name, p->prefix, p->quota, p->hard, p->policy, p->size(),
+                                        p->capacity(), p->reads, p->hits, p->curve.samples(), p->curve.curve()});
+        }
+        return stats;
+    }
+
+    void printStats() const {
+        CacheStats stats = getStats();
+        cout << "Cache stats: " << stats.reads << " reads, " << stats.hits << " hits, "
+             << stats.misses << " misses (hit ratio " << fixed << setprecision(2)
+             << stats.hitRatio() << ")" << endl;
+        cout << "Cached entries: " << stats.entries << " of " << stats.capacity << endl;
+        if (stats.expired) cout << "Expired by TTL: " << stats.expired << endl;
+        if (stats.prefetched || stats.bypassed) {
+            cout << "Prefetched: " << stats.prefetched << ", served without caching: " << stats.bypassed << endl;
+        }
+        if (stats.adaptive) {
+            cout << "Adaptive policy: LRU " << stats.lruShare << " / LFU " << stats.lfuShare << " entries, "
+                 << stats.lfuHits << " LFU hits, " << stats.policyShifts << " shifts (ghost hit ratio LRU "
+                 << stats.ghostLruHitRatio << ", LFU " << stats.ghostLfuHitRatio << ")" << endl;
+        }
+        for (const auto& p : stats.partitions) {
+            cout << "Partition " << p.name << " ('" << p.prefix << "*', " << (p.hard ? "hard" : "soft") << " quota "
+                 << p.quota << ", " << evictionPolicyName(p.policy) << "): " << p.entries << " of " << p.capacity
+                 << " entries, " << p.reads << " reads, hit ratio " << p.hitRatio() << endl;
+        }
+        cout << "Estimated hit ratio by capacity (sampling rate "
+             << stats.samplingRate << ", " << stats.sampledAccesses << " samples):" << endl;
+        for (const auto& p : stats.missRatioCurve) {
+            cout << "- " << p.multiplier << "x (" << p.capacity << " entries): "
+                 << p.hitRatio << endl;
+        }
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+    }
+};
+
+// ========================= MEMORY PRESSURE CONTROL =========================
+// Reads process RSS, the cgroup memory limit and usage (v2 memory.max /
+// memory.current, or v1 memory.limit_in_bytes / memory.usage_in_bytes) and
+// physical memory. Inside a limited cgroup the cgroup's own usage and limit
+// are what count towards the OOM killer; otherwise RSS against physical memory.
+struct MemoryReading {
+    uint64_t rssBytes = 0;
+    uint64_t cgroupUsage = 0;
+    uint64_t cgroupLimit = 0;   // 0 when the cgroup is unlimited or unknown
+    uint64_t physicalBytes = 0;
+    uint64_t usage() const { return cgroupLimit ? cgroupUsage : rssBytes; }
+    uint64_t limit() const { return cgroupLimit ? cgroupLimit : physicalBytes; }
+};
+
+class MemoryProbe {
+private:
+    static bool readNumber(const string& path, uint64_t& value) {
+        ifstream in(path);
+        string text;
+        if (!(in >> text) || text == "max") return false;
+        value = strtoull(text.c_str(), nullptr, 10);
+        return value < (1ull << 60);   // v1 reports "unlimited" as ~2^63
+    }
+    static bool readCgroup(MemoryReading& r) {
+        ifstream self("/proc/self/cgroup");
+        string line, v2Path, v1Path;
+        while (getline(self, line)) {
+            if (line.compare(0, 3, "0::") == 0) v2Path = line.substr(3);
+            size_t pos = line.find(":memory:");
+            if (pos != string::npos) v1Path = line.substr(pos + 8);
+        }
+        vector<pair<string, string>> candidates;
+        for (const string& dir : {"/sys/fs/cgroup" + v2Path, string("/sys/fs/cgroup")}) {
+            candidates.push_back({dir + "/memory.max", dir + "/memory.current"});
+        }
+        for (const string& dir : {"/sys/fs/cgroup/memory" + v1Path, string("/sys/fs/cgroup/memory")}) {
+            candidates.push_back({dir + "/memory.limit_in_bytes", dir + "/memory.usage_in_bytes"});
+        }
+        for (const auto& c : candidates) {
+            uint64_t limit = 0, usage = 0;
+            if (readNumber(c.first, limit) && readNumber(c.second, usage)) {
+                r.cgroupLimit = limit;
+                r.cgroupUsage = usage;
+                return true;
+            }
+        }
+        return false;
+    }
+public:
+    static MemoryReading read() {
+        MemoryReading r;
+        ifstream statm("/proc/self/statm");
+        uint64_t pages = 0, resident = 0;
+        if (statm >> pages >> resident) r.rssBytes = resident * sysconf(_SC_PAGESIZE);
+        readCgroup(r);
+        ifstream meminfo("/proc/meminfo");
+        string key;
+        uint64_t kb = 0;
+        while (meminfo >> key >> kb) {
+            if (key == "MemTotal:") {
+                r.physicalBytes = kb * 1024;
+                break;
+            }
+            meminfo.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+        return r;
+    }
+};
+
+struct MemoryControlConfig {
+    uint64_t targetBytes = 0;     // 0: targetRatio of the limit
+    double targetRatio = 0.8;
+    double hysteresis = 0.1;      // grow only below target * (1 - hysteresis)
+    double growStep = 0.1;        // fraction of capacity added per step
+    size_t minCapacity = 16;
+    size_t maxCapacity = 1 << 20;
+    uint32_t intervalMs = 1000;
+
+    static MemoryControlConfig fromCommandLine(const struct CommandLine& cmd);
+};
+
+// Feedback loop on the cache capacity. Above the target the capacity is cut
+// in proportion to the overshoot (by 10% to 50% a step); below the
+// hysteresis band it grows by growStep; in between it holds, so the
+// capacity does not oscillate around the target. Capacity counts entries,
+// so the loop acts on measured memory rather than on per-entry sizes.
+class MemoryPressureController {
+public:
+    enum class Action { Hold, Shrink, Grow };
+    struct Decision {
+        Action action = Action::Hold;
+        size_t capacity = 0;
+        uint64_t targetBytes = 0;
+        MemoryReading reading;
+    };
+private:
+    FileSystem& fs;
+    MemoryControlConfig cfg;
+    mutex stateMutex;
+    condition_variable stopSignal;
+    bool stopping = false;
+    Decision last;
+    uint64_t steps = 0;
+    thread worker;
+public:
+    MemoryPressureController(FileSystem& f, const MemoryControlConfig& c) : fs(f), cfg(c) {}
+    ~MemoryPressureController() { stop(); }
+
+    Decision step() {
+        Decision d;
+        d.reading = MemoryProbe::read();
+        uint64_t used = d.reading.usage();
+        d.targetBytes = cfg.targetBytes ? cfg.targetBytes : static_cast<uint64_t>(d.reading.limit() * cfg.targetRatio);
+        size_t capacity = fs.getCacheCapacity();
+        d.capacity = capacity;
+        if (used > d.targetBytes && capacity > cfg.minCapacity) {
+            double factor = min(0.9, max(0.5, static_cast<double>(d.targetBytes) / used));
+            d.capacity = max(cfg.minCapacity, static_cast<size_t>(capacity * factor));
+            d.action = Action::Shrink;
+        } else if (used < d.targetBytes * (1.0 - cfg.hysteresis) && capacity < cfg.maxCapacity) {
+            d.capacity = min(cfg.maxCapacity, capacity + max<size_t>(1, static_cast<size_t>(capacity * cfg.growStep)));
+            d.action = Action::Grow;
+        }
+        if (d.capacity != capacity) fs.resizeCache(d.capacity);
+#ifdef __GLIBC__
+        if (d.action == Action::Shrink) malloc_trim(0);   // hand freed entries back to the OS
+#endif
+        lock_guard<mutex> lock(stateMutex);
+        last = d;
+        steps++;
+        return d;
+    }
+
+    void start() {
+        if (worker.joinable()) return;
+        stopping = false;
+        worker = thread([this] {
+            unique_lock<mutex> lock(stateMutex);
+            while (!stopSignal.wait_for(lock, chrono::milliseconds(cfg.intervalMs), [this] { return stopping; })) {
+                lock.unlock();
+                step();
+                lock.lock();
+            }
+        });
+    }
+    void stop() {
+        {
+            lock_guard<mutex> lock(stateMutex);
+            stopping = true;
+        }
+        stopSignal.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+
+    void print() {
+        lock_guard<mutex> lock(stateMutex);
+        const MemoryReading& r = last.reading;
+        static const char* actions[] = {"hold", "shrink", "grow"};
+        cout << "Memory: usage " << r.usage() << " of limit " << r.limit() << " bytes (rss " << r.rssBytes
+             << (r.cgroupLimit ? ", cgroup-limited" : ", no cgroup limit") << "); target " << last.targetBytes
+             << ", capacity " << last.capacity << " after " << steps << " step(s), last action "
+             << actions[static_cast<int>(last.action)] << endl;
+    }
+};
+
+// ========================= UTILITY-BASED PARTITIONING =========================
+// Periodically redistributes the combined partition quota between tenants
+// with the lookahead algorithm of utility-based cache partitioning: starting
+// from a minimum each, the next units always go to the tenant whose curve
+// promises the most extra hits per unit over any number of further units,
+// so a tenant whose curve only rises after a plateau still gets its share.
+// Hits are hit ratio times sampled reads, which weights tenants by traffic.
+// The shared caches are left alone.
+struct PartitionControlConfig {
+    uint32_t intervalMs = 1000;
+    uint64_t minSamples = 256;    // sampled partition reads needed before a step acts
+    int minUnits = 1;             // floor per tenant, in 1/CURVE_POINTS of the combined quota
+
+    static PartitionControlConfig fromCommandLine(const struct CommandLine& cmd);
+};
+
+class UtilityPartitioner {
+public:
+    struct Allocation {
+        string name;
+        size_t quota = 0;
+        double hitRatio = 0.0;    // measured over the partition's lifetime
+        double expected = 0.0;    // estimated by its curve at `quota`
+    };
+    struct Decision {
+        bool applied = false;
+        uint64_t samples = 0;
+        vector<Allocation> allocations;
+    };
+private:
+    FileSystem& fs;
+    PartitionControlConfig cfg;
+    mutex stateMutex;
+    condition_variable stopSignal;
+    bool stopping = false;
+    Decision last;
+    uint64_t steps = 0;
+    thread worker;
+
+    // units[i] for each tenant, summing to `total`
+    static vector<int> lookahead(const vector<vector<double>>& hits, int total, int minUnits) {
+        vector<int> units(hits.size(), minUnits);
+        int remaining = total - minUnits * static_cast<int>(hits.size());
+        while (remaining > 0) {
+            int best = -1, bestUnits = 0;
+            double bestUtility = 0.0;
+            for (size_t t = 0; t < hits.size(); t++) {
+                for (int k = 1; k <= remaining && units[t] + k <= total; k++) {
+                    double utility = (hits[t][units[t] + k] - hits[t][units[t]]) / k;
+                    if (utility > bestUtility) best = static_cast<int>(t), bestUnits = k, bestUtility = utility;
+                }
+            }
+            if (best < 0) break;
+            units[best] += bestUnits;
+            remaining -= bestUnits;
+        }
+        // Units nobody gains from are spread evenly
+        for (size_t t = 0; remaining > 0; t = (t + 1) % units.size()) units[t]++, remaining--;
+        return units;
+    }
+public:
+    UtilityPartitioner(FileSystem& f, const PartitionControlConfig& c) : fs(f), cfg(c) {}
+    ~UtilityPartitioner() { stop(); }
+
+    Decision step() {
+        Decision d;
+        CacheStats stats = fs.getStats();
+        const int total = CachePartition::CURVE_POINTS;
+        size_t budget = 0;
+        vector<vector<double>> hits;
+        for (const auto& p : stats.partitions) {
+            budget += p.quota;
+            d.samples += p.sampledReads;
+            vector<double> curve(1, 0.0);
+            for (const auto& point : p.missRatioCurve) curve.push_back(point.hitRatio * p.sampledReads);
+            hits.push_back(move(curve));
+            d.allocations.push_back({p.name, p.quota, p.hitRatio(), 0.0});
+        }
+        int minUnits = max(0, min(cfg.minUnits, total / max<int>(1, static_cast<int>(hits.size()))));
+        if (hits.size() > 1 && d.samples >= cfg.minSamples) {
+            vector<int> units = lookahead(hits, total, minUnits);
+            map<string, size_t> quotas;
+            size_t assigned = 0;
+            for (size_t t = 0; t < units.size(); t++) {
+                Allocation& a = d.allocations[t];
+                a.quota = budget * units[t] / total;
+                assigned += a.quota;
+                uint64_t reads = stats.partitions[t].sampledReads;
+                a.expected = reads ? hits[t][units[t]] / reads : 0.0;
+            }
+            // Rounding leftovers go to the largest allocation
+            auto largest = max_element(d.allocations.begin(), d.allocations.end(),
+                                       [](const Allocation& x, const Allocation& y) { return x.quota < y.quota; });
+            largest->quota += budget - assigned;
+            for (const auto& a : d.allocations) quotas[a.name] = a.quota;
+            d.applied = fs.setPartitionQuotas(quotas) == FsStatus::Ok;
+        }
+        lock_guard<mutex> lock(stateMutex);
+        last = d;
+        steps++;
+        return d;
+    }
+
+    void start() {
+        if (worker.joinable()) return;
+        stopping = false;
+        worker = thread([this] {
+            unique_lock<mutex> lock(stateMutex);
+            while (!stopSignal.wait_for(lock, chrono::milliseconds(cfg.intervalMs), [this] { return stopping; })) {
+                lock.unlock();
+                step();
+                lock.lock();
+            }
+        });
+    }
+    void stop() {
+        {
+            lock_guard<mutex> lock(stateMutex);
+            stopping = true;
+        }
+        stopSignal.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+
+    void print() {
+        lock_guard<mutex> lock(stateMutex);
+        cout << "Partitioner: " << steps << " step(s), last " << (last.applied ? "reallocated" : "held") << " on "
+             << last.samples << " sampled reads" << endl;
+        cout << fixed << setprecision(2);
+        for (const auto& a : last.allocations) {
+            cout << "- " << a.name << ": quota " << a.quota << ", hit ratio " << a.hitRatio;
+            if (last.applied) cout << " (expected " << a.expected << ")";
+            cout << endl;
+        }
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+    }
+};
+
+// ========================= BENCHMARK SUPPORT =========================
+// A malformed flag value; main() and the shell report it instead of dying
+struct UsageError : runtime_error {
+    using runtime_error::runtime_error;
+};
+
+// Flags are "--name=value" or a bare "--name" (treated as "1").
+struct CommandLine {
+    vector<string> positional;
+    map<string, string> flags;
+
+    CommandLine(int argc, char* argv[], int first)
+        : CommandLine(vector<string>(argv + min(first, argc), argv + argc)) {}
+
+    CommandLine(const vector<string>& args) {
+        for (const string& arg : args) {
+            if (arg.rfind("--", 0) == 0) {
+                size_t eq = arg.find('=');
+                if (eq == string::npos) flags[arg.substr(2)] = "1";
+                else flags[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+            } else {
+                positional.push_back(arg);
+            }
+        }
+    }
+    bool has(const string& name) const { return flags.count(name) > 0; }
+    string get(const string& name, const string& def = "") const {
+        auto it = flags.find(name);
+        return it == flags.end() ? def : it->second;
+    }
+    long long getInt(const string& name, long long def) const {
+        auto it = flags.find(name);
+        return it == flags.end() ? def : parseInt(name, it->second);
+    }
+    double getDouble(const string& name, double def) const {
+        auto it = flags.find(name);
+        if (it == flags.end()) return def;
+        const char* text = it->second.c_str();
+        char* end = nullptr;
+        errno = 0;
+        double value = strtod(text, &end);
+        if (end == text || *end || errno == ERANGE) {
+            throw UsageError("--" + name + " expects a number, got '" + it->second + "'");
+        }
+        return value;
+    }
+    // Whole-string base-10 integer; throws UsageError naming the flag
+    static long long parseInt(const string& name, const string& value) {
+        const char* text = value.c_str();
+        char* end = nullptr;
+        errno = 0;
+        long long parsed = strtoll(text, &end, 10);
+        if (end == text || *end || errno == ERANGE) {
+            throw UsageError("--" + name + " expects an integer, got '" + value + "'");
+        }
+        return parsed;
+    }
+};
+
+// --mem-target=BYTES --mem-ratio=R --mem-hysteresis=R --mem-interval-ms=N
+// --min-cache=N --max-cache=N
+MemoryControlConfig MemoryControlConfig::fromCommandLine(const CommandLine& cmd) {
+    MemoryControlConfig cfg;
+    cfg.targetBytes = cmd.getInt("mem-target", cfg.targetBytes);
+    cfg.targetRatio = cmd.getDouble("mem-ratio", cfg.targetRatio);
+    cfg.hysteresis = cmd.getDouble("mem-hysteresis", cfg.hysteresis);
+    cfg.intervalMs = cmd.getInt("mem-interval-ms", cfg.intervalMs);
+    cfg.minCapacity = cmd.getInt("min-cache", cfg.minCapacity);
+    cfg.maxCapacity = cmd.getInt("max-cache", cfg.maxCapacity);
+    return cfg;
+}
+
+PartitionControlConfig PartitionControlConfig::fromCommandLine(const CommandLine& cmd) {
+    PartitionControlConfig cfg;
+    cfg.intervalMs = cmd.getInt("rebalance-interval-ms", cfg.intervalMs);
+    cfg.minSamples = cmd.getInt("rebalance-min-samples", cfg.minSamples);
+    cfg.minUnits = cmd.getInt("rebalance-min-units", cfg.minUnits);
+    return cfg;
+}
+
+// Collects repeated measurements per metric so results can be compared
+// statistically across builds. JSON layout:
+//   {"benchmark": name, "params": {...},
+//    "metrics": {metric: {"unit": u, "better": "higher"|"lower", "samples": [...]}}}
+class BenchReport {
+private:
+    struct Metric {
+        string name;
+        string unit;
+        bool higherIsBetter;
+        vector<double> samples;
+    };
+    string name;
+    vector<pair<string, string>> params;
+    vector<Metric> metrics;
+
+    static string quote(const string& s) {
+        string out = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        return out + "\"";
+    }
+public:
+    BenchReport(const string& n) : name(n) {}
+
+    void param(const string& key, const string& value) { params.emplace_back(key, value); }
+
+    void add(const string& metric, const string& unit, bool higherIsBetter, double value) {
+        for (auto& m : metrics) {
+            if (m.name == metric) {
+                m.samples.push_back(value);
+                return;
+            }
+        }
+        metrics.push_back({metric, unit, higherIsBetter, {value}});
+    }
+
+    void print() const {
+        cout << "Benchmark: " << name << endl;
+        for (const auto& p : params) cout << "  " << p.first << " = " << p.second << endl;
+        for (const auto& m : metrics) {
+            double mean = 0, var = 0;
+            for (double v : m.samples) mean += v;
+            mean /= m.samples.size();
+            for (double v : m.samples) var += (v - mean) * (v - mean);
+            double sd = m.samples.size() > 1 ? sqrt(var / (m.samples.size() - 1)) : 0.0;
+            cout << "  " << left << setw(40) << m.name << right << fixed << setprecision(3)
+                 << setw(16) << mean << " " << m.unit << "  (sd " << sd << ", n=" << m.samples.size() << ")" << endl;
+        }
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+    }
+
+    bool writeJson(const string& path) const {
+        ofstream out(path);
+        if (!out) return false;
+        out << "{\n  \"benchmark\": " << quote(name) << ",\n  \"params\": {";
+        for (size_t i = 0; i < params.size(); i++) {
+            out << (i ? ", " : "") << quote(params[i].first) << ": " << quote(params[i].second);
+        }
+        out << "},\n  \"metrics\": {\n" << setprecision(17);
+        for (size_t i = 0; i < metrics.size(); i++) {
+            const auto& m = metrics[i];
+            out << "    " << quote(m.name) << ": {\"unit\": " << quote(m.unit) << ", \"better\": "
+                << (m.higherIsBetter ? "\"higher\"" : "\"lower\"") << ", \"samples\": [";
+            for (size_t j = 0; j < m.samples.size(); j++) out << (j ? ", " : "") << m.samples[j];
+            out << "]}" << (i + 1 < metrics.size() ? "," : "") << "\n";
+        }
+        out << "  }\n}\n";
+        return static_cast<bool>(out);
+    }
+
+    // Prints the summary and, when --json=<path> was given, writes the samples.
+    int finish(const CommandLine& cmd) const {
+        print();
+        if (cmd.has("json")) {
+            if (!writeJson(cmd.get("json"))) {
+                cerr << "Cannot write '" << cmd.get("json") << "'" << endl;
+                return 1;
+            }
+            cout << "Results written to '" << cmd.get("json") << "'" << endl;
+        }
+        return 0;
+    }
+};
+
+inline double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// ========================= WORKLOAD GENERATOR =========================
+// Zipf-distributed mix of reads, writes and delete/create churn over a fixed
+// set of file names. Each thread draws from its own seeded generator.
+struct WorkloadConfig {
+    size_t files = 1000;
+    uint64_t opsPerThread = 100000;
+    double readRatio = 0.90;
+    double writeRatio = 0.08;      // remainder is delete-or-recreate churn
+    double zipfSkew = 0.99;
+    size_t valueSize = 64;
+    uint64_t seed = 42;
+
+    static WorkloadConfig fromCommandLine(const CommandLine& cmd) {
+        WorkloadConfig cfg;
+        cfg.files = cmd.getInt("files", cfg.files);
+        cfg.opsPerThread = cmd.getInt("ops", cfg.opsPerThread);
+        cfg.readRatio = cmd.getDouble("read-ratio", cfg.readRatio);
+        cfg.writeRatio = cmd.getDouble("write-ratio", cfg.writeRatio);
+        cfg.zipfSkew = cmd.getDouble("zipf", cfg.zipfSkew);
+        cfg.valueSize = cmd.getInt("size", cfg.valueSize);
+        cfg.seed = cmd.getInt("seed", cfg.seed);
+        return cfg;
+    }
+};
+
+class ZipfGenerator {
+private:
+    vector<double> cdf;
+public:
+    ZipfGenerator(size_t n, double skew) : cdf(max<size_t>(1, n)) {
+        double sum = 0;
+        for (size_t i = 0; i < cdf.size(); i++) {
+            sum += 1.0 / pow(static_cast<double>(i + 1), skew);
+            cdf[i] = sum;
+        }
+        for (auto& c : cdf) c /= sum;
+    }
+    size_t next(mt19937_64& rng) const {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        return min<size_t>(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size() - 1);
+    }
+};
+
+class Workload {
+private:
+    WorkloadConfig cfg;
+    ZipfGenerator zipf;
+    vector<string> names;
+    string payload;
+public:
+    Workload(const WorkloadConfig& c)
+        : cfg(c), zipf(c.files, c.zipfSkew), payload(c.valueSize, 'x') {
+        for (size_t i = 0; i < cfg.files; i++) names.push_back("file" + to_string(i) + ".dat");
+    }
+
+    const WorkloadConfig& config() const { return cfg; }
+
+    void populate(FileSystem& fs) const {
+        for (const auto& n : names) fs.createFile(n, payload);
+    }
+
+    void run(FileSystem& fs, size_t thread) const {
+        mt19937_64 rng(cfg.seed + thread * 7919);
+        uniform_real_distribution<double> pick(0.0, 1.0);
+        for (uint64_t i = 0; i < cfg.opsPerThread; i++) {
+            const string& name = names[zipf.next(rng)];
+            double p = pick(rng);
+            if (p < cfg.readRatio) {
+                fs.readFile(name);
+            } else if (p < cfg.readRatio + cfg.writeRatio) {
+                fs.writeFile(name, payload);
+            } else if (fs.deleteFile(name) != FsStatus::Ok) {
+                fs.createFile(name, payload);
+            }
+        }
+    }
+};
+
+// Runs the generator against a fresh FileSystem; optionally records the traffic.
+int runWorkloadCommand(const CommandLine& cmd) {
+    WorkloadConfig cfg = WorkloadConfig::fromCommandLine(cmd);
+    size_t threads = cmd.getInt("threads", 1);
+    size_t cacheSize = cmd.getInt("cache", 256);
+    int runs = cmd.getInt("runs", 1);
+    Workload workload(cfg);
+
+    BenchReport report("workload");
+    report.param("threads", to_string(threads));
+    report.param("files", to_string(cfg.files));
+    report.param("ops_per_thread", to_string(cfg.opsPerThread));
+    report.param("cache", to_string(cacheSize));
+    bool adaptive = cmd.get("policy") == "adaptive";
+    if (adaptive) report.param("policy", "adaptive");
+    for (int r = 0; r < runs; r++) {
+        FileSystem fs(cacheSize);
+        fs.setVerbose(false);
+        if (adaptive) fs.setCachePolicy(CachePolicy::Adaptive);
+        fs.setPhaseSampling(cmd.getInt("phase-sample", 0));
+        if (cmd.has("record") && r == 0 && !fs.startRecording(cmd.get("record"))) {
+            cerr << "Cannot open trace file '" << cmd.get("record") << "'" << endl;
+            return 1;
+        }
+        workload.populate(fs);
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (size_t t = 0; t < threads; t++) {
+            workers.emplace_back([&fs, &workload, t] { workload.run(fs, t); });
+        }
+        for (auto& w : workers) w.join();
+        double secs = secondsSince(start);
+        fs.stopRecording();
+        report.add("ops_per_sec", "ops/s", true, cfg.opsPerThread * threads / secs);
+        report.add("hit_ratio", "ratio", true, fs.getStats().hitRatio());
+        if (cmd.has("phase-sample") && r == runs - 1) {
+            cout << "readFile phase breakdown (1 in " << cmd.get("phase-sample") << " reads):" << endl;
+            fs.printPhaseProfile();
+        }
+    }
+    if (cmd.has("record")) cout << "Trace recorded to '" << cmd.get("record") << "'" << endl;
+    return report.finish(cmd);
+}
+
+// ========================= SCALABILITY BENCHMARK =========================
+// Runs the mixed workload at 1, 2, 4, ... up to --max-threads and reports
+// throughput scaling plus per-lock-class contention for each step.
+int runScaleCommand(const CommandLine& cmd) {
+    WorkloadConfig cfg = WorkloadConfig::fromCommandLine(cmd);
+    size_t maxThreads = cmd.getInt("max-threads", max(1u, thread::hardware_concurrency()));
+    size_t cacheSize = cmd.getInt("cache", 256);
+    int runs = cmd.getInt("runs", 1);
+    Workload workload(cfg);
+
+    vector<size_t> steps;
+    for (size_t t = 1; t < maxThreads; t *= 2) steps.push_back(t);
+    steps.push_back(maxThreads);
+
+    BenchReport report("scale");
+    report.param("max_threads", to_string(maxThreads));
+    report.param("files", to_string(cfg.files));
+    report.param("ops_per_thread", to_string(cfg.opsPerThread));
+    report.param("cache", to_string(cacheSize));
+
+    double baseline = 0;
+    cout << "threads        ops/s  speedup  efficiency" << endl;
+    for (size_t threads : steps) {
+        double best = 0;
+        for (int r = 0; r < runs; r++) {
+            FileSystem fs(cacheSize);
+            fs.setVerbose(false);
+            workload.populate(fs);
+            LockProfiler::resetAll();
+            auto start = chrono::steady_clock::now();
+            vector<thread> workers;
+            for (size_t t = 0; t < threads; t++) {
+                workers.emplace_back([&fs, &workload, t] { workload.run(fs, t); });
+            }
+            for (auto& w : workers) w.join();
+            double secs = secondsSince(start);
+            double opsPerSec = cfg.opsPerThread * threads / secs;
+            best = max(best, opsPerSec);
+            string suffix = "_t" + to_string(threads);
+            report.add("ops_per_sec" + suffix, "ops/s", true, opsPerSec);
+            LockProfiler::forEach([&](LockClassStats& c) {
+                if (c.acquisitions == 0) return;
+                report.add("lock_wait_ms_" + c.name + suffix, "ms", false, c.waitNs / 1e6);
+                report.add("lock_contended_pct_" + c.name + suffix, "%", false,
+                           100.0 * c.contended / c.acquisitions);
+                report.add("lock_migrations_pct_" + c.name + suffix, "%", false,
+                           100.0 * c.migrations / c.acquisitions);
+            });
+        }
+        if (threads == 1) baseline = best;
+        double speedup = baseline ? best / baseline : 0;
+        cout << setw(7) << threads << fixed << setprecision(0) << setw(13) << best
+             << setprecision(2) << setw(9) << speedup << setw(11) << speedup / threads << endl;
+
+        // Contention breakdown from the last run at this thread count
+        LockProfiler::forEach([&](LockClassStats& c) {
+            if (c.acquisitions == 0) return;
+            uint64_t acq = c.acquisitions, cont = c.contended, mig = c.migrations;
+            cout << "        lock " << left << setw(12) << c.name << right
+                 << " acquisitions " << acq
+                 << ", contended " << setprecision(1) << 100.0 * cont / acq << "%"
+                 << ", wait " << setprecision(2) << c.waitNs / 1e6 << " ms"
+                 << " (avg " << setprecision(0) << (cont ? c.waitNs / static_cast<double>(cont) : 0.0) << " ns)"
+                 << ", line migrations " << setprecision(1) << 100.0 * mig / acq << "%" << endl;
+        });
+        cout.unsetf(ios::floatfield);
+    }
+    cout << setprecision(6);
+    return report.finish(cmd);
+}
+
+// ========================= MEMORY FOOTPRINT BENCHMARK =========================
+// Builds each component on its own with N entries and reports the heap and
+// RSS growth per entry, and how much of that is overhead beyond the key and
+// content bytes themselves. Heap numbers come from glibc's allocator
+// statistics where available and are exact; RSS is page-granular.
+struct MemorySnapshot {
+    size_t heapBytes = 0;
+    size_t rssBytes = 0;
+
+    static MemorySnapshot take() {
+        MemorySnapshot snap;
+#ifdef __GLIBC__
+        struct mallinfo2 info = mallinfo2();
+        snap.heapBytes = info.uordblks + info.hblkhd;
+#endif
+        ifstream statm("/proc/self/statm");
+        size_t pages = 0, resident = 0;
+        if (statm >> pages >> resident) snap.rssBytes = resident * sysconf(_SC_PAGESIZE);
+        return snap;
+    }
+};
+
+int runFootprintCommand(const CommandLine& cmd) {
+    size_t count = cmd.getInt("count", 100000);
+    int runs = cmd.getInt("runs", 1);
+    vector<size_t> sizes;
+    {
+        stringstream list(cmd.get("sizes", "16,256,4096"));
+        string item;
+        while (getline(list, item, ',')) sizes.push_back(CommandLine::parseInt("sizes", item));
+    }
+
+    BenchReport report("footprint");
+    report.param("count", to_string(count));
+    report.param("sizes", cmd.get("sizes", "16,256,4096"));
+
+    for (size_t size : sizes) {
+        vector<string> keys, contents;
+        for (size_t i = 0; i < count; i++) {
+            ostringstream os;
+            os << "data/file" << setw(8) << setfill('0') << i << ".bin";
+            keys.push_back(os.str());
+            contents.push_back(string(size, static_cast<char>('a' + i % 26)));
+        }
+        size_t payload = keys[0].size() + size;
+
+        cout << "\n" << count << " entries of " << size << " bytes (payload "
+             << payload << " B/entry incl. key)" << endl;
+        cout << left << setw(14) << "component" << right << setw(14) << "heap B/entry"
+             << setw(16) << "overhead B/ent" << setw(14) << "RSS B/entry"
+             << setw(16) << "leaked B/entry" << endl;
+
+        auto measure = [&](const string& component, function<shared_ptr<void>()> build) {
+            for (int r = 0; r < runs; r++) {
+                MemorySnapshot before = MemorySnapshot::take();
+                shared_ptr<void> built = build();
+                MemorySnapshot after = MemorySnapshot::take();
+                built.reset();
+                MemorySnapshot released = MemorySnapshot::take();
+
+                double heap = (static_cast<double>(after.heapBytes) - before.heapBytes) / count;
+                double rss = (static_cast<double>(after.rssBytes) - before.rssBytes) / count;
+                double leaked = (static_cast<double>(released.heapBytes) - before.heapBytes) / count;
+                // Relative to one copy of key + content; the MRC ghosts hold sampled keys
+                // only, and the full FileSystem shows what duplicating content costs
+                double overhead = heap - (component == "mrc-ghosts" ? 0.0 : static_cast<double>(payload));
+                string suffix = "_" + component + "_" + to_string(size);
+                report.add("heap_per_entry" + suffix, "B", false, heap);
+                report.add("overhead_per_entry" + suffix, "B", false, overhead);
+                report.add("rss_per_entry" + suffix, "B", false, rss);
+                if (r == runs - 1) {
+                    cout << left << setw(14) << component << right << fixed << setprecision(1)
+                         << setw(14) << heap << setw(16) << overhead << setw(14) << rss
+                         << setw(16) << leaked << endl;
+                    cout.unsetf(ios::floatfield);
+                    cout << setprecision(6);
+                }
+            }
+        };
+
+        measure("directory", [&] {
+            auto dir = make_shared<Directory>("root");
+            for (size_t i = 0; i < count; i++) dir->createFile(keys[i], contents[i]);
+            return static_pointer_cast<void>(dir);
+        });
+        measure("lru", [&] {
+            auto lru = make_shared<LRUCache<string, string>>(count);
+            for (size_t i = 0; i < count; i++) lru->put(keys[i], contents[i]);
+            return static_pointer_cast<void>(lru);
+        });
+        measure("lfu", [&] {
+            auto lfu = make_shared<LFUCache<string, string>>(count);
+            for (size_t i = 0; i < count; i++) lfu->put(keys[i], contents[i]);
+            return static_pointer_cast<void>(lfu);
+        });
+        measure("mrc-ghosts", [&] {
+            auto mrc = make_shared<MissRatioEstimator>(count);
+            for (size_t i = 0; i < count; i++) mrc->access(keys[i], false);
+            return static_pointer_cast<void>(mrc);
+        });
+        measure("filesystem", [&] {
+            auto fs = make_shared<FileSystem>(count);
+            fs->setVerbose(false);
+            for (size_t i = 0; i < count; i++) fs->createFile(keys[i], contents[i]);
+            return static_pointer_cast<void>(fs);
+        });
+    }
+    cout << endl;
+    return report.finish(cmd);
+}
+
+// ========================= CACHE MICROBENCHMARKS =========================
+// Hot-path timings in ns/op: cache hits, evicting inserts and readFile.
+// Each run is one sample so results can be compared across builds.
+int runMicrobenchCommand(const CommandLine& cmd) {
+    size_t entries = cmd.getInt("entries", 1024);
+    uint64_t iters = cmd.getInt("iters", 1000000);
+    int runs = cmd.getInt("runs", 5);
+    string content(cmd.getInt("size", 64), 'x');
+    vector<string> keys;
+    for (size_t i = 0; i < entries * 2; i++) keys.push_back("bench/file" + to_string(i) + ".dat");
+
+    BenchReport report("microbench");
+    report.param("entries", to_string(entries));
+    report.param("iters", to_string(iters));
+    report.param("size", to_string(content.size()));
+
+    size_t sink = 0;
+    auto time = [&](const string& metric, function<void(uint64_t)> body) {
+        uint64_t allocsBefore = AllocRegistry::totalAllocations;
+        auto start = chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iters; i++) body(i);
+        report.add(metric, "ns/op", false, secondsSince(start) * 1e9 / iters);
+#ifdef FS_COUNT_ALLOCS
+        report.add(metric + "_allocs", "allocs/op", false,
+                   static_cast<double>(AllocRegistry::totalAllocations - allocsBefore) / iters);
+#else
+        (void)allocsBefore;
+#endif
+    };
+    for (int r = 0; r < runs; r++) {
+        LRUCache<string, string> lru(entries);
+        LFUCache<string, string> lfu(entries);
+        for (size_t i = 0; i < entries; i++) {
+            lru.put(keys[i], content);
+            lfu.put(keys[i], content);
+        }
+        time("lru_get_hit", [&](uint64_t i) { sink += lru.get(keys[i % entries]).size(); });
+        time("lfu_get_hit", [&](uint64_t i) { sink += lfu.get(keys[i % entries]).size(); });
+        time("lru_put_evict", [&](uint64_t i) { lru.put(keys[i % (entries * 2)], content); });
+
+        FileSystem fs(entries);
+        fs.setVerbose(false);
+        for (size_t i = 0; i < entries * 2; i++) fs.createFile(keys[i], content);
+        for (size_t i = entries; i < entries * 2; i++) fs.readFile(keys[i]);
+        time("readfile_hit", [&](uint64_t i) { sink += fs.readFile(keys[entries + i % entries]).value().size(); });
+        string buffer;
+        time("readfile_hit_buffer", [&](uint64_t i) {
+            sink += fs.readFile(keys[entries + i % entries], buffer) == FsStatus::Ok;
+        });
+        // Alternating halves keeps every read a miss in an LRU of this size
+        time("readfile_miss", [&](uint64_t i) { sink += fs.readFile(keys[i % (entries * 2)]).value().size(); });
+    }
+    if (sink == 42) cout << "";
+    return report.finish(cmd);
+}
+
+// ========================= ALLOCATION CHECK =========================
+// Runs each operation over a warmed-up file system and reports allocations
+// per call for every instrumented tag. Fails when a cache hit through
+// readFile(name, buffer) allocates, so the hit path stays allocation-free.
+int runAllocCheckCommand(const CommandLine& cmd) {
+#ifndef FS_COUNT_ALLOCS
+    (void)cmd;
+    cerr << "alloc-check needs the instrumented build: make alloc && ./filesystem_alloc alloc-check" << endl;
+    return 2;
+#else
+    size_t cacheSize = cmd.getInt("cache", 4);
+    uint64_t iters = cmd.getInt("iters", 10000);
+    string content(cmd.getInt("size", 256), 'x');
+    FileSystem fs(cacheSize);
+    fs.setVerbose(false);
+
+    // Enough distinct files to fill every MRC ghost, all with equal-length names
+    vector<string> names;
+    for (size_t i = 0; i < cacheSize * 8; i++) {
+        ostringstream os;
+        os << "alloc/file" << setw(6) << setfill('0') << i << ".dat";
+        names.push_back(os.str());
+    }
+    for (const auto& n : names) fs.createFile(n, content);
+    for (const auto& n : names) fs.readFile(n);
+    vector<string> hot(names.end() - cacheSize, names.end());
+    string buffer;
+    for (int round = 0; round < 3; round++) {
+        for (const auto& n : hot) fs.readFile(n, buffer);
+    }
+
+    struct Phase {
+        string name;
+        uint64_t allocations;
+    };
+    vector<Phase> phases;
+    auto phase = [&](const string& name, function<void(uint64_t)> body) {
+        uint64_t before = AllocRegistry::totalAllocations;
+        for (uint64_t i = 0; i < iters; i++) body(i);
+        uint64_t made = AllocRegistry::totalAllocations - before;
+        phases.push_back({name, made});
+    };
+
+    AllocRegistry::resetAll();
+    phase("read hit (buffer)", [&](uint64_t i) { fs.readFile(hot[i % hot.size()], buffer); });
+    uint64_t hitAllocations = phases.back().allocations;
+    phase("read hit (string)", [&](uint64_t i) { fs.readFile(hot[i % hot.size()]); });
+    phase("read miss", [&](uint64_t i) { fs.readFile(names[i % (names.size() - cacheSize)], buffer); });
+    phase("write", [&](uint64_t i) { fs.writeFile(hot[i % hot.size()], content); });
+    phase("delete+create", [&](uint64_t i) {
+        fs.deleteFile(names[i % names.size()]);
+        fs.createFile(names[i % names.size()], content);
+    });
+
+    cout << left << setw(24) << "phase" << right << setw(14) << "allocs/op" << endl;
+    for (const auto& p : phases) {
+        cout << left << setw(24) << p.name << right << fixed << setprecision(2)
+             << setw(14) << static_cast<double>(p.allocations) / iters << endl;
+    }
+    cout << "\n" << left << setw(24) << "tag" << right << setw(12) << "calls"
+         << setw(14) << "allocs/call" << setw(14) << "bytes/call" << endl;
+    AllocRegistry::forEach([](AllocCounters& c) {
+        if (c.calls == 0) return;
+        cout << left << setw(24) << c.tag << right << setw(12) << c.calls.load()
+             << setw(14) << static_cast<double>(c.allocations) / c.calls
+             << setw(14) << static_cast<double>(c.bytes) / c.calls << endl;
+    });
+    cout.unsetf(ios::floatfield);
+    cout << setprecision(6);
+
+    if (hitAllocations) {
+        cout << "\nFAIL: cache hit path made " << hitAllocations << " allocations in "
+             << iters << " reads" << endl;
+        return 1;
+    }
+    cout << "\nPASS: cache hit path is allocation-free" << endl;
+    return 0;
+#endif
+}
+
+// ========================= SELF TEST =========================
+// Coherence checks for the caches and FileSystem: whatever the capacity,
+// partitioning or policy, a read returns the content last written, plus the
+// cache templates' eviction, TTL and aging rules and the partitioner. Each
+// case prints PASS or FAIL; the command fails if any case does (`make test`).
+// `--only=<text>` runs the matching cases; `--seed=N` varies the randomized
+// model's operation sequences.
+class SelfTest {
+private:
+    struct Case {
+        string name;
+        function<void(SelfTest&)> body;
+    };
+    vector<Case> cases;
+    string current;
+    int failures = 0;
+    int caseFailures = 0;
+public:
+    void add(const string& name, function<void(SelfTest&)> body) { cases.push_back({name, move(body)}); }
+
+    void check(bool ok, const string& what) {
+        if (ok) return;
+        if (caseFailures++ < 5) cout << "  " << current << ": " << what << endl;
+    }
+    // Reads `name` through the buffer API and compares with `expected`
+    void expectContent(FileSystem& fs, const string& name, const string& expected) {
+        string out;
+        FsStatus status = fs.readFile(name, out);
+        check(status == FsStatus::Ok && out == expected,
+              "read '" + name + "' returned " + (status == FsStatus::Ok ? "'" + out + "'" : statusMessage(status)) +
+              ", expected '" + expected + "'");
+    }
+
+    int run(const string& only) {
+        int ran = 0;
+        for (auto& c : cases) {
+            if (!only.empty() && c.name.find(only) == string::npos) continue;
+            current = c.name;
+            caseFailures = 0;
+            c.body(*this);
+            ran++;
+            if (caseFailures) failures++;
+            cout << (caseFailures ? "FAIL " : "PASS ") << c.name << endl;
+        }
+        cout << ran - failures << " of " << ran << " case(s) passed" << endl;
+        return failures || !ran ? 1 : 0;
+    }
+};
+
+// A file system that does not print per operation
+static unique_ptr<FileSystem> quietFileSystem(size_t cacheSize) {
+    auto fs = make_unique<FileSystem>(cacheSize);
+    fs->setVerbose(false);
+    return fs;
+}
+
+void addServerSelfTests(SelfTest& t);   // with the socket server
+
+int runSelfTestCommand(const CommandLine& cmd) {
+    SelfTest t;
+
+    // Entries outlive a capacity of 0 while a shrink is in progress (more
+    // than a few batches) and for good when pinned
+    t.add("write at zero partition capacity", [](SelfTest& t) {
+        const int files = 400;
+        for (auto eviction : {EvictionPolicy::Lru, EvictionPolicy::Lfu}) {
+            for (bool hard : {true, false}) {
+                auto fs = quietFileSystem(files * 2);
+                fs->setPartition("b", "b/", files, hard, eviction);
+                for (int i = 0; i < files; i++) fs->createFile("b/" + to_string(i), "old");
+                fs->pin("b/0");
+                fs->setPartitionQuotas({{"b", 0}});
+                fs->writeFile("b/0", "new");
+                fs->writeFile("b/" + to_string(files - 1), "new");
+                t.expectContent(*fs, "b/0", "new");
+                t.expectContent(*fs, "b/" + to_string(files - 1), "new");
+            }
+        }
+    });
+
+    t.add("write after shrinking the cache to 0", [](SelfTest& t) {
+        const int files = 400;
+        for (bool adaptive : {false, true}) {
+            auto fs = quietFileSystem(files);
+            if (adaptive) fs->setCachePolicy(CachePolicy::Adaptive);
+            for (int i = 0; i < files; i++) fs->createFile("f" + to_string(i), "old");
+            fs->pin("f0");
+            fs->resizeCache(0);
+            fs->writeFile("f0", "new");
+            fs->writeFile("f" + to_string(files - 1), "new");
+            t.expectContent(*fs, "f0", "new");
+            t.expectContent(*fs, "f" + to_string(files - 1), "new");
+            fs->resizeCache(files);
+            fs->writeFile("f1", "grown");
+            t.expectContent(*fs, "f1", "grown");
+        }
+    });
+
+    // Capped at 1, frequency gives way to recency: the often-read entry is
+    // the oldest and goes first
+    t.add("partition LFU follows the aging config", [](SelfTest& t) {
+        auto fs = quietFileSystem(4);
+        fs->setLfuAging(0, 1);
+        fs->setPartition("p", "p/", 2, true, EvictionPolicy::Lfu);
+        fs->createFile("p/a", "a");
+        string out;
+        for (int i = 0; i < 10; i++) fs->readFile("p/a", out);
+        fs->createFile("p/b", "b");
+        fs->createFile("p/c", "c");
+        uint64_t hits = fs->getStats().partitions[0].hits;
+        fs->readFile("p/a", out);
+        t.check(fs->getStats().partitions[0].hits == hits, "p/a kept its frequency past the cap");
+    });
+
+    // The curve's 1x point and the live cache count the same reads
+    t.add("miss-ratio curve matches the live hit ratio", [](SelfTest& t) {
+        auto fs = quietFileSystem(8);
+        fs->createFile("f", "f");
+        string out;
+        fs->readFile("f", out);
+        fs->readFile("missing", out);
+        fs->readFile("missing", out);
+        fs->readFile("f", out);
+        CacheStats stats = fs->getStats();
+        auto it = find_if(stats.missRatioCurve.begin(), stats.missRatioCurve.end(),
+                          [](const MrcPoint& p) { return p.multiplier == 1.0; });
+        t.check(it != stats.missRatioCurve.end() && it->hitRatio == stats.hitRatio(),
+                "curve at 1x differs from the live hit ratio " + to_string(stats.hitRatio()));
+    });
+
+    // The default TTL expires ordinary entries but never a pinned one, even
+    // after the pinned file is rewritten
+    // A pinned file stays cached when a partition takes over or gives back
+    // its name; a partition too small for the pinned files is refused
+    t.add("pinned files move between partitions", [](SelfTest& t) {
+        for (bool hard : {true, false}) {
+            auto fs = quietFileSystem(8);
+            string kind = hard ? "hard" : "soft";
+            fs->createFile("cfg/x", "x");
+            fs->createFile("cfg/y", "y");
+            fs->createFile("cfg/z", "z");
+            fs->pin("cfg/x");
+            fs->pin("cfg/y");
+            string out;
+            auto hit = [&](const string& name) {
+                uint64_t hits = fs->getStats().hits;
+                fs->readFile(name, out);
+                return fs->getStats().hits == hits + 1;
+            };
+            t.check(fs->setPartition("cfg", "cfg/", 1, hard) == FsStatus::NoSpace,
+                    kind + ": a quota of 1 took two pinned files");
+            t.check(fs->getStats().partitions.empty() && hit("cfg/x"), kind + ": refused partition left changes behind");
+            t.check(fs->setPartition("cfg", "cfg/", 2, hard) == FsStatus::Ok, kind + ": partition refused");
+            t.check(hit("cfg/x") && hit("cfg/y"), kind + ": pinned file dropped by setPartition");
+            t.check(fs->setPartition("cfg", "cfg/x", 1, hard) == FsStatus::Ok, kind + ": replacement refused");
+            t.check(hit("cfg/x") && hit("cfg/y"), kind + ": pinned file dropped by a replaced partition");
+            t.check(fs->removePartition("cfg") == FsStatus::Ok, kind + ": removal refused");
+            t.check(hit("cfg/x") && hit("cfg/y"), kind + ": pinned file dropped by removePartition");
+            t.expectContent(*fs, "cfg/z", "z");
+        }
+    });
+
+    // One read in N, counted per thread from a fresh countdown
+    t.add("phase sampling rate", [](SelfTest& t) {
+        for (uint32_t every : {1u, 4u, 7u}) {
+            size_t sampled = 0;
+            thread([&] {
+                PhaseProfile profile;
+                profile.setSampleEvery(every);
+                for (int i = 0; i < 1000; i++) sampled += profile.shouldSample();
+            }).join();
+            size_t want = (1000 + every - 1) / every;
+            t.check(sampled == want, "every " + to_string(every) + " sampled " + to_string(sampled) +
+                                         " of 1000 reads, expected " + to_string(want));
+        }
+    });
+
+    t.add("pinned files outlive the default TTL", [](SelfTest& t) {
+        for (bool adaptive : {false, true}) {
+            auto fs = quietFileSystem(8);
+            if (adaptive) fs->setCachePolicy(CachePolicy::Adaptive);
+            fs->setCacheTtl(5);
+            fs->createFile("pinned", "p");
+            fs->createFile("plain", "q");
+            fs->pin("pinned");
+            fs->writeFile("pinned", "p2");
+            this_thread::sleep_for(chrono::milliseconds(30));
+            string out;
+            uint64_t hits = fs->getStats().hits;
+            fs->readFile("pinned", out);
+            t.check(fs->getStats().hits == hits + 1, string(adaptive ? "adaptive" : "classic") + ": pinned file expired");
+            hits = fs->getStats().hits;
+            fs->readFile("plain", out);
+            t.check(fs->getStats().hits == hits, string(adaptive ? "adaptive" : "classic") + ": TTL did not apply");
+            t.expectContent(*fs, "pinned", "p2");
+        }
+    });
+
+    // Exact and prefix watches see only their names, a transaction's events
+    // arrive together in order, and a full ring counts what it drops
+    t.add("watch queues", [](SelfTest& t) {
+        auto fs = quietFileSystem(8);
+        auto exact = fs->watch("cfg");
+        auto logs = fs->watch("logs/", true);
+        auto small = fs->watch("hot", false, 2);
+        fs->createFile("cfg", "1");
+        fs->createFile("cfg2", "1");
+        fs->createFile("logs/a", "1");
+        fs->createFile("other/a", "1");
+        vector<WatchEvent> events;
+        exact->poll(events);
+        t.check(events.size() == 1 && events[0].name == "cfg" && events[0].kind == WatchEventKind::Create,
+                "exact watch saw " + to_string(events.size()) + " event(s)");
+        events.clear();
+        logs->poll(events);
+        t.check(events.size() == 1 && events[0].name == "logs/a", "prefix watch saw " + to_string(events.size()) + " event(s)");
+
+        Transaction tx;
+        tx.write("logs/a", "22").create("logs/b", "3").rename("logs/b", "logs/c");
+        fs->commit(move(tx));
+        events.clear();
+        logs->poll(events);
+        vector<pair<WatchEventKind, string>> want = {{WatchEventKind::Write, "logs/a"}, {WatchEventKind::Create, "logs/b"},
+                                                     {WatchEventKind::Delete, "logs/b"}, {WatchEventKind::Create, "logs/c"}};
+        bool inOrder = events.size() == want.size();
+        for (size_t i = 0; inOrder && i < want.size(); i++) {
+            inOrder = events[i].kind == want[i].first && events[i].name == want[i].second &&
+                      (i == 0 || events[i].sequence == events[i - 1].sequence + 1);
+        }
+        t.check(inOrder, "transaction batch has " + to_string(events.size()) + " event(s), expected 4 in order");
+        t.check(events.size() == 4 && events[0].size == 2, "write event lost its size");
+
+        fs->createFile("hot", "0");
+        for (int i = 0; i < 4; i++) fs->writeFile("hot", "x");
+        events.clear();
+        small->poll(events);
+        t.check(events.size() == 2 && small->droppedEvents() == 3,
+                "full ring kept " + to_string(events.size()) + " and dropped " + to_string(small->droppedEvents()));
+        fs->writeFile("hot", "y");
+        events.clear();
+        t.check(small->poll(events) == 1, "ring did not recover after draining");
+
+        fs->unwatch(exact);
+        fs->writeFile("cfg", "2");
+        events.clear();
+        t.check(exact->poll(events) == 0, "unwatched queue still receives events");
+    });
+
+    // Two recorders alternating on one thread each see a single client, and
+    // coarse clock ticks still give every record its own timestamp
+    t.add("trace recorders sharing a thread", [](SelfTest& t) {
+        string paths[2] = {"/tmp/selftest_trace_a.bin", "/tmp/selftest_trace_b.bin"};
+        {
+            TraceRecorder a(paths[0]), b(paths[1]);
+            for (int i = 0; i < 100; i++) {
+                a.record(TraceOp::Read, "a" + to_string(i), 1);
+                b.record(TraceOp::Write, "b" + to_string(i), 1);
+            }
+        }
+        for (const string& path : paths) {
+            vector<TraceRecord> records;
+            t.check(TraceRecorder::load(path, records), "cannot load " + path);
+            t.check(records.size() == 100, path + " has " + to_string(records.size()) + " records, expected 100");
+            bool oneClient = all_of(records.begin(), records.end(), [](const TraceRecord& r) { return r.client == 0; });
+            t.check(oneClient, path + " has more than one client");
+            bool increasing = adjacent_find(records.begin(), records.end(), [](const TraceRecord& a, const TraceRecord& b) {
+                return a.timestampNs >= b.timestampNs;
+            }) == records.end();
+            t.check(increasing, path + " has timestamps out of order or tied");
+            remove(path.c_str());
+        }
+    });
+
+    // Each expired file counts once: in classic mode the LFU shadows every
+    // LRU entry, in adaptive mode the LFU may hold files the LRU does not
+    t.add("TTL expiry count", [](SelfTest& t) {
+        string out;
+        auto classic = quietFileSystem(8);
+        classic->setCacheTtl(5);
+        for (int i = 0; i < 4; i++) classic->createFile("f" + to_string(i), "x");
+        this_thread::sleep_for(chrono::milliseconds(30));
+        classic->readFile("missing", out);
+        t.check(classic->getStats().expired == 4, "classic: " + to_string(classic->getStats().expired) + " expired, expected 4");
+
+        auto adaptive = quietFileSystem(8);
+        adaptive->setCachePolicy(CachePolicy::Adaptive);
+        adaptive->setCacheTtl(5);
+        for (int i = 0; i < 4; i++) adaptive->createFile("f" + to_string(i), "x");
+        for (int round = 0; round < 3; round++) {
+            for (int i = 0; i < 4; i++) adaptive->readFile("f" + to_string(i), out);
+        }
+        for (int i = 0; i < 4; i++) adaptive->createFile("g" + to_string(i), "x");
+        this_thread::sleep_for(chrono::milliseconds(30));
+        adaptive->readFile("missing", out);
+        CacheStats stats = adaptive->getStats();
+        t.check(stats.expired > stats.lruShare && stats.expired <= 8,
+                "adaptive: " + to_string(stats.expired) + " expired with an LRU share of " + to_string(stats.lruShare));
+    });
+
+    // Low goes before Normal, pinned entries never go, and within a class
+    // the older (LRU) or less used (LFU) entry goes first
+    t.add("cache priorities and pins", [](SelfTest& t) {
+        auto scenario = [&t](auto& cache, const string& which) {
+            cache.put("low", "1", 0, CachePriority::Low);
+            cache.put("old", "2");
+            cache.put("pinned", "3");
+            cache.pin("pinned");
+            cache.put("d", "4");
+            t.check(!cache.contains("low"), which + ": low-priority entry survived");
+            cache.put("e", "5");
+            t.check(!cache.contains("old"), which + ": oldest normal entry survived");
+            for (int i = 0; i < 10; i++) cache.put("x" + to_string(i), "x");
+            t.check(cache.contains("pinned"), which + ": pinned entry was evicted");
+            cache.unpin("pinned");
+            for (int i = 0; i < 10; i++) cache.put("y" + to_string(i), "y");
+            t.check(!cache.contains("pinned"), which + ": unpinned entry was never evicted");
+            t.check(cache.size() == 3, which + ": holds " + to_string(cache.size()) + " entries, expected 3");
+        };
+        LRUCache<string, string> lru(3);
+        LFUCache<string, string> lfu(3);
+        scenario(lru, "lru");
+        scenario(lfu, "lfu");
+    });
+
+    // Lookups hide an expired entry at once; expire() reclaims it; clearing
+    // the TTL cancels the timer
+    t.add("cache TTL timer wheel", [](SelfTest& t) {
+        auto scenario = [&t](auto& cache, const string& which) {
+            cache.put("short", "1", 1);
+            cache.put("long", "2", 60000);
+            cache.put("cleared", "3", 1);
+            cache.setTtl("cleared", 0);
+            cache.put("plain", "4");
+            this_thread::sleep_for(chrono::milliseconds(20));
+            t.check(!cache.lookup("short"), which + ": expired entry still served");
+            size_t expired = cache.expire(SIZE_MAX);
+            t.check(expired == 0 || !cache.contains("short"), which + ": expire() kept the expired entry");
+            t.check(cache.lookup("long") && cache.lookup("cleared") && cache.lookup("plain"),
+                    which + ": an unexpired entry was dropped");
+            cache.put("batch0", "x", 1);
+            cache.put("batch1", "x", 1);
+            this_thread::sleep_for(chrono::milliseconds(20));
+            t.check(cache.expire(1) == 1 && cache.expire(SIZE_MAX) == 1, which + ": expire() ignored its limit");
+            t.check(cache.size() == 3, which + ": holds " + to_string(cache.size()) + " entries, expected 3");
+        };
+        LRUCache<string, string> lru(8);
+        LFUCache<string, string> lfu(8);
+        scenario(lru, "lru");
+        scenario(lfu, "lfu");
+    });
+
+    // Each hint reaches the cache: WillNeed loads in the background,
+    // DontNeed drops, Sequential goes first, NoReuse bypasses and survives
+    // a WillNeed
+    t.add("access hints", [](SelfTest& t) {
+        auto fs = quietFileSystem(2);
+        auto hit = [&fs](const string& name) {
+            string out;
+            uint64_t hits = fs->getStats().hits;
+            fs->readFile(name, out);
+            return fs->getStats().hits == hits + 1;
+        };
+        auto prefetched = [&fs](uint64_t want) {
+            for (int i = 0; i < 200 && fs->getStats().prefetched < want; i++) {
+                this_thread::sleep_for(chrono::milliseconds(5));
+            }
+            return fs->getStats().prefetched == want;
+        };
+        fs->createFile("will", "w");
+        fs->createFile("a", "a");
+        fs->createFile("b", "b");
+        fs->advise("will", Advice::WillNeed);
+        t.check(prefetched(1) && hit("will"), "WillNeed did not load the file");
+
+        fs->advise("will", Advice::DontNeed);
+        t.check(!hit("will"), "DontNeed kept the cached copy");
+        fs->pin("will");
+        fs->advise("will", Advice::DontNeed);
+        t.check(hit("will"), "DontNeed dropped a pinned file");
+        fs->unpin("will");
+
+        fs->createFile("keep", "k");
+        fs->createFile("seq", "s");
+        fs->advise("seq", Advice::Sequential);
+        fs->createFile("next", "n");
+        t.check(hit("keep") && !hit("seq"), "Sequential file was not evicted first");
+
+        fs->advise("keep", Advice::NoReuse);
+        uint64_t bypassed = fs->getStats().bypassed;
+        t.check(!hit("keep") && !hit("keep"), "NoReuse file was cached on a miss");
+        t.check(fs->getStats().bypassed == bypassed + 2, "NoReuse misses were not counted as bypassed");
+        fs->advise("keep", Advice::WillNeed);
+        t.check(prefetched(2) && hit("keep"), "WillNeed did not load a NoReuse file");
+        fs->advise("keep", Advice::DontNeed);
+        bypassed = fs->getStats().bypassed;
+        t.check(!hit("keep") && fs->getStats().bypassed == bypassed + 1, "WillNeed cleared the NoReuse hint");
+        t.expectContent(*fs, "keep", "k");
+    });
+
+    // The coarse clocks stay within a few ticks of the precise ones and
+    // the monotonic one never steps back
+    t.add("coarse clock", [](SelfTest& t) {
+        auto systemMs = [] {
+            return static_cast<uint64_t>(chrono::duration_cast<chrono::milliseconds>(
+                chrono::system_clock::now().time_since_epoch()).count());
+        };
+        uint64_t before = systemMs();
+        uint64_t coarse = CoarseClock::nowMs();
+        uint64_t after = systemMs();
+        t.check(coarse + 50 >= before && coarse <= after + 50,
+                "nowMs() is " + to_string(static_cast<int64_t>(coarse - before)) + " ms off the system clock");
+        uint64_t last = CoarseClock::monotonicNs();
+        bool ordered = true;
+        for (int i = 0; i < 10000; i++) {
+            uint64_t now = CoarseClock::monotonicNs();
+            ordered = ordered && now >= last;
+            last = now;
+        }
+        t.check(ordered, "monotonicNs() went backwards");
+        this_thread::sleep_for(chrono::milliseconds(30));
+        uint64_t later = CoarseClock::monotonicNs();
+        t.check(later >= last + 10000000, "monotonicNs() advanced " + to_string(later - last) + " ns in 30 ms");
+    });
+
+    // Halving lets a once-popular entry fall back to its newer rivals
+    t.add("LFU aging", [](SelfTest& t) {
+        LFUCache<string, string> lfu(2);
+        lfu.put("old", "1");
+        for (int i = 0; i < 5; i++) lfu.touch("old");
+        lfu.put("new", "2");
+        lfu.touch("new");
+        lfu.touch("new");
+        for (int i = 0; i < 3; i++) lfu.age();
+        lfu.touch("new");
+        lfu.put("next", "3");
+        t.check(!lfu.contains("old") && lfu.contains("new"), "aged entry outlived a more recent favourite");
+
+        LFUCache<string, string> periodic(2);
+        periodic.setAging(4);
+        periodic.put("old", "1");
+        for (int i = 0; i < 40; i++) periodic.touch("old");
+        periodic.put("new", "2");
+        for (int i = 0; i < 3; i++) periodic.touch("new");
+        periodic.put("next", "3");
+        t.check(!periodic.contains("old"), "periodic halving did not bring the frequency down");
+
+        // A period below the capacity is stretched to it, so counts still build up
+        LFUCache<string, string> eager(4);
+        eager.setAging(1);
+        eager.put("hot", "1");
+        for (int i = 0; i < 2; i++) eager.touch("hot");
+        for (const char* key : {"a", "b", "c", "next"}) eager.put(key, "2");
+        t.check(eager.contains("hot"), "aging every access kept all frequencies at 1");
+    });
+
+    // A tenant cycling through 70 files gains from the slots a tenant
+    // reading 20 does not use; the combined quota stays the same
+    t.add("utility partitioner", [](SelfTest& t) {
+        auto fs = quietFileSystem(100);
+        fs->setPartition("a", "a/", 50);
+        fs->setPartition("b", "b/", 50);
+        for (int i = 0; i < 70; i++) fs->createFile("a/" + to_string(i), "a");
+        for (int i = 0; i < 20; i++) fs->createFile("b/" + to_string(i), "b");
+        string out;
+        for (int round = 0; round < 20; round++) {
+            for (int i = 0; i < 70; i++) fs->readFile("a/" + to_string(i), out);
+            for (int i = 0; i < 20; i++) fs->readFile("b/" + to_string(i), out);
+        }
+        UtilityPartitioner partitioner(*fs, PartitionControlConfig{});
+        auto decision = partitioner.step();
+        CacheStats stats = fs->getStats();
+        t.check(decision.applied, "no reallocation");
+        t.check(stats.partitions.size() == 2 && stats.partitions[0].quota + stats.partitions[1].quota == 100,
+                "quotas no longer add up to 100");
+        t.check(stats.partitions[0].quota >= 70, "a/ got " + to_string(stats.partitions[0].quota) + " slots");
+        for (int i = 0; i < 70; i++) fs->readFile("a/" + to_string(i), out);
+        uint64_t hits = fs->getStats().partitions[0].hits;
+        for (int i = 0; i < 70; i++) fs->readFile("a/" + to_string(i), out);
+        t.check(fs->getStats().partitions[0].hits == hits + 70, "a/ still misses at its new quota");
+        t.expectContent(*fs, "b/0", "b");
+    });
+
+    // Random operations against a map of what each name should hold, while
+    // the cache is resized, partitioned, re-policied, aged, pinned and given
+    // TTLs underneath. Every read must return the model's content.
+    t.add("randomized model", [seed = static_cast<uint64_t>(cmd.getInt("seed", 1))](SelfTest& t) {
+        const int rounds = 8, steps = 3000;
+        for (uint64_t r = 0; r < rounds; r++) {
+            mt19937_64 rng(seed + r);
+            auto pick = [&rng](size_t n) { return static_cast<size_t>(rng() % n); };
+            string where = "seed " + to_string(seed + r);
+            vector<string> names;
+            for (const char* prefix : {"a/", "b/", "c"}) {
+                for (int i = 0; i < 24; i++) names.push_back(prefix + to_string(i));
+            }
+            map<string, string> model;
+            auto fs = quietFileSystem(32);
+            UtilityPartitioner partitioner(*fs, PartitionControlConfig{});
+            auto anyName = [&] { return names[pick(names.size())]; };
+            auto content = [&](int step) { return "v" + to_string(step) + string(pick(4), 'x'); };
+            auto expectRead = [&](const string& name, int step) {
+                auto it = model.find(name);
+                string out;
+                FsStatus status;
+                if (pick(2)) {
+                    status = fs->readFile(name, out, pick(4) ? CacheMode::Default : CacheMode::Bypass);
+                } else {
+                    FsResult<string> result = fs->readFile(name);
+                    status = result.status();
+                    out = result.value();
+                }
+                bool ok = it == model.end() ? status == FsStatus::NotFound
+                                            : status == FsStatus::Ok && out == it->second;
+                t.check(ok, where + " step " + to_string(step) + ": read '" + name + "' returned " +
+                            (status == FsStatus::Ok ? "'" + out + "'" : statusMessage(status)) + ", expected " +
+                            (it == model.end() ? "not found" : "'" + it->second + "'"));
+            };
+            auto expectStatus = [&](FsStatus got, FsStatus want, const string& what, int step) {
+                t.check(got == want, where + " step " + to_string(step) + ": " + what + " returned " +
+                                         statusMessage(got) + ", expected " + statusMessage(want));
+            };
+
+            for (int step = 0; step < steps; step++) {
+                string name = anyName();
+                bool exists = model.count(name) != 0;
+                int op = static_cast<int>(pick(100));
+                if (op < 35) {
+                    expectRead(name, step);
+                } else if (op < 50) {
+                    string value = content(step);
+                    expectStatus(fs->writeFile(name, value), exists ? FsStatus::Ok : FsStatus::NotFound,
+                                 "write '" + name + "'", step);
+                    if (exists) model[name] = value;
+                } else if (op < 60) {
+                    string value = content(step);
+                    expectStatus(fs->createFile(name, value), exists ? FsStatus::AlreadyExists : FsStatus::Ok,
+                                 "create '" + name + "'", step);
+                    if (!exists) model[name] = value;
+                } else if (op < 64) {
+                    expectStatus(fs->deleteFile(name), exists ? FsStatus::Ok : FsStatus::NotFound,
+                                 "delete '" + name + "'", step);
+                    model.erase(name);
+                } else if (op < 68) {
+                    string to = anyName();
+                    FsStatus want = !exists ? FsStatus::NotFound
+                                            : model.count(to) ? FsStatus::AlreadyExists : FsStatus::Ok;
+                    expectStatus(fs->renameFile(name, to), want, "rename '" + name + "' to '" + to + "'", step);
+                    if (want == FsStatus::Ok) model[to] = model[name], model.erase(name);
+                } else if (op < 74) {
+                    // A transaction either applies every operation or none
+                    Transaction tx;
+                    map<string, string> staged = model;
+                    FsStatus want = FsStatus::Ok;
+                    for (size_t i = 0, n = 1 + pick(4); i < n; i++) {
+                        string a = anyName(), b = anyName(), value = content(step);
+                        bool has = staged.count(a) != 0;
+                        FsStatus s = FsStatus::Ok;
+                        switch (pick(4)) {
+                            case 0:
+                                tx.create(a, value);
+                                if (has) s = FsStatus::AlreadyExists;
+                                else staged[a] = value;
+                                break;
+                            case 1:
+                                tx.write(a, value);
+                                if (!has) s = FsStatus::NotFound;
+                                else staged[a] = value;
+                                break;
+                            case 2:
+                                tx.remove(a);
+                                if (!has) s = FsStatus::NotFound;
+                                else staged.erase(a);
+                                break;
+                            default:
+                                tx.rename(a, b);
+                                if (!has) s = FsStatus::NotFound;
+                                else if (staged.count(b)) s = FsStatus::AlreadyExists;
+                                else staged[b] = staged[a], staged.erase(a);
+                                break;
+                        }
+                        if (want == FsStatus::Ok) want = s;
+                    }
+                    expectStatus(fs->commit(move(tx)), want, "commit", step);
+                    if (want == FsStatus::Ok) model = move(staged);
+                } else if (op < 77) {
+                    fs->resizeCache(pick(4) ? 8 + pick(56) : pick(4));
+                } else if (op < 81) {
+                    string part = pick(2) ? "pa" : "pb";
+                    size_t quota = pick(fs->getCacheCapacity() / 2 + 1);
+                    fs->setPartition(part, part == "pa" ? "a/" : "b/", quota, pick(2) != 0,
+                                     pick(2) ? EvictionPolicy::Lru : EvictionPolicy::Lfu);
+                } else if (op < 83) {
+                    fs->removePartition(pick(2) ? "pa" : "pb");
+                } else if (op < 85) {
+                    map<string, size_t> quotas;
+                    size_t capacity = fs->getCacheCapacity();
+                    for (const auto& p : fs->getStats().partitions) quotas[p.name] = pick(capacity / 2 + 1);
+                    fs->setPartitionQuotas(quotas);
+                } else if (op < 86) {
+                    partitioner.step();
+                } else if (op < 88) {
+                    fs->setCachePolicy(pick(2) ? CachePolicy::Adaptive : CachePolicy::Classic);
+                } else if (op < 89) {
+                    fs->setLfuAging(pick(3) ? pick(16) : 0, pick(2) ? 1 + static_cast<int>(pick(8)) : INT_MAX);
+                } else if (op < 92) {
+                    pick(3) ? fs->pin(name) : fs->unpin(name);
+                } else if (op < 94) {
+                    fs->setPriority(name, static_cast<CachePriority>(pick(3)));
+                } else if (op < 96) {
+                    fs->setCacheTtl(name, pick(2) ? 1 + pick(3) : 0);
+                } else if (op < 97) {
+                    fs->setCacheTtl(pick(3) ? 0 : 1 + pick(5));
+                } else {
+                    static const Advice advice[] = {Advice::Normal, Advice::WillNeed, Advice::DontNeed,
+                                                    Advice::Sequential, Advice::Random, Advice::NoReuse};
+                    fs->advise(name, advice[pick(6)]);
+                }
+                if (step % 500 == 499) {
+                    for (const string& n : names) expectRead(n, step);
+                }
+            }
+        }
+    });
+
+    addServerSelfTests(t);
+    return t.run(cmd.get("only"));
+}
+
+// ========================= BENCHMARK COMPARISON =========================
+// Compares two BenchReport JSON files metric by metric with Welch's t-test
+// and flags changes in the "worse" direction that exceed --threshold percent
+// and are significant at --confidence. Exits non-zero on any regression, so
+// it can gate a build.
+struct JsonValue {
+    enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+    bool boolean = false;
+    double number = 0;
+    string str;
+    vector<JsonValue> items;
+    vector<pair<string, JsonValue>> fields;
+
+    const JsonValue* find(const string& key) const {
+        for (const auto& f : fields) {
+            if (f.first == key) return &f.second;
+        }
+        return nullptr;
+    }
+};
+
+class JsonParser {
+private:
+    const string& text;
+    size_t pos = 0;
+
+    void skipSpace() {
+        while (pos < text.size() && isspace(static_cast<unsigned char>(text[pos]))) pos++;
+    }
+    bool literal(const char* word) {
+        size_t len = strlen(word);
+        if (text.compare(pos, len, word) != 0) return false;
+        pos += len;
+        return true;
+    }
+    bool parseString(string& out) {
+        if (text[pos] != '"') return false;
+        for (pos++; pos < text.size(); pos++) {
+            char c = text[pos];
+            if (c == '"') {
+                pos++;
+                return true;
+            }
+            if (c == '\\' && ++pos < text.size()) c = text[pos] == 'n' ? '\n' : text[pos] == 't' ? '\t' : text[pos];
+            out += c;
+        }
+        return false;
+    }
+public:
+    JsonParser(const string& t) : text(t) {}
+
+    bool parse(JsonValue& v) {
+        skipSpace();
+        if (pos >= text.size()) return false;
+        char c = text[pos];
+        if (c == '{') {
+            v.type = JsonValue::Object;
+            pos++;
+            skipSpace();
+            if (pos < text.size() && text[pos] == '}') return ++pos, true;
+            while (true) {
+                skipSpace();
+                string key;
+                if (pos >= text.size() || !parseString(key)) return false;
+                skipSpace();
+                if (pos >= text.size() || text[pos++] != ':') return false;
+                JsonValue child;
+                if (!parse(child)) return false;
+                v.fields.emplace_back(key, move(child));
+                skipSpace();
+                if (pos >= text.size()) return false;
+                if (text[pos] == ',') { pos++; continue; }
+                return text[pos++] == '}';
+            }
+        }
+        if (c == '[') {
+            v.type = JsonValue::Array;
+            pos++;
+            skipSpace();
+            if (pos < text.size() && text[pos] == ']') return ++pos, true;
+            while (true) {
+                JsonValue child;
+                if (!parse(child)) return false;
+                v.items.push_back(move(child));
+                skipSpace();
+                if (pos >= text.size()) return false;
+                if (text[pos] == ',') { pos++; continue; }
+                return text[pos++] == ']';
+            }
+        }
+        if (c == '"') {
+            v.type = JsonValue::String;
+            return parseString(v.str);
+        }
+        if (literal("true")) { v.type = JsonValue::Bool; v.boolean = true; return true; }
+        if (literal("false")) { v.type = JsonValue::Bool; return true; }
+        if (literal("null")) return true;
+        char* end = nullptr;
+        v.number = strtod(text.c_str() + pos, &end);
+        if (end == text.c_str() + pos) return false;
+        v.type = JsonValue::Number;
+        pos = end - text.c_str();
+        return true;
+    }
+
+    static bool parseFile(const string& path, JsonValue& v) {
+        ifstream in(path);
+        if (!in) return false;
+        string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        JsonParser parser(text);
+        return parser.parse(v);
+    }
+};
+
+// Student's t distribution via the regularized incomplete beta function
+// (continued fraction, Numerical Recipes 6.4).
+class StudentT {
+private:
+    static double betaContinuedFraction(double a, double b, double x) {
+        const double tiny = 1e-300;
+        double qab = a + b, qap = a + 1, qam = a - 1;
+        double c = 1, d = 1 - qab * x / qap;
+        if (fabs(d) < tiny) d = tiny;
+        d = 1 / d;
+        double h = d;
+        for (int m = 1; m <= 200; m++) {
+            int m2 = 2 * m;
+            double aa = m * (b - m) * x / ((qam + m2) * (a + m2));
+            d = 1 + aa * d; if (fabs(d) < tiny) d = tiny;
+            c = 1 + aa / c; if (fabs(c) < tiny) c = tiny;
+            d = 1 / d;
+            h *= d * c;
+            aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2));
+            d = 1 + aa * d; if (fabs(d) < tiny) d = tiny;
+            c = 1 + aa / c; if (fabs(c) < tiny) c = tiny;
+            d = 1 / d;
+            double del = d * c;
+            h *= del;
+            if (fabs(del - 1) < 1e-12) break;
+        }
+        return h;
+    }
+    static double incompleteBeta(double a, double b, double x) {
+        if (x <= 0) return 0;
+        if (x >= 1) return 1;
+        double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x));
+        if (x < (a + 1) / (a + b + 2)) return front * betaContinuedFraction(a, b, x) / a;
+        return 1 - front * betaContinuedFraction(b, a, 1 - x) / b;
+    }
+public:
+    // P(|T| > t) for df degrees of freedom
+    static double twoSidedP(double t, double df) {
+        return incompleteBeta(df / 2, 0.5, df / (df + t * t));
+    }
+    // t such that P(|T| > t) = alpha, by bisection
+    static double critical(double alpha, double df) {
+        double lo = 0, hi = 1000;
+        for (int i = 0; i < 100; i++) {
+            double mid = (lo + hi) / 2;
+            if (twoSidedP(mid, df) > alpha) lo = mid; else hi = mid;
+        }
+        return (lo + hi) / 2;
+    }
+};
+
+struct SampleSummary {
+    double mean = 0, variance = 0;
+    size_t n = 0;
+
+    static SampleSummary of(const JsonValue& samples) {
+        SampleSummary s;
+        for (const auto& v : samples.items) s.mean += v.number;
+        s.n = samples.items.size();
+        if (s.n) s.mean /= s.n;
+        for (const auto& v : samples.items) s.variance += (v.number - s.mean) * (v.number - s.mean);
+        if (s.n > 1) s.variance /= s.n - 1;
+        return s;
+    }
+};
+
+int runCompareCommand(const CommandLine& cmd) {
+    if (cmd.positional.size() != 2) {
+        cerr << "usage: filesystem compare <baseline.json> <candidate.json> [--threshold=5] [--confidence=0.95]" << endl;
+        return 2;
+    }
+    double threshold = cmd.getDouble("threshold", 5.0);
+    double confidence = cmd.getDouble("confidence", 0.95);
+    JsonValue base, cand;
+    if (!JsonParser::parseFile(cmd.positional[0], base) || !JsonParser::parseFile(cmd.positional[1], cand)) {
+        cerr << "Cannot parse benchmark results" << endl;
+        return 1;
+    }
+    const JsonValue* baseMetrics = base.find("metrics");
+    const JsonValue* candMetrics = cand.find("metrics");
+    if (!baseMetrics || !candMetrics) {
+        cerr << "Missing \"metrics\" object" << endl;
+        return 1;
+    }
+
+    int regressions = 0;
+    cout << left << setw(40) << "metric" << right << setw(14) << "baseline" << setw(14) << "candidate"
+         << setw(10) << "change" << setw(24) << "CI of change" << setw(9) << "p" << "  verdict" << endl;
+    for (const auto& field : baseMetrics->fields) {
+        const JsonValue* other = candMetrics->find(field.first);
+        const JsonValue* baseSamples = field.second.find("samples");
+        if (!other || !baseSamples || !other->find("samples")) continue;
+        const JsonValue* better = field.second.find("better");
+        bool higherIsBetter = better && better->str == "higher";
+        SampleSummary a = SampleSummary::of(*baseSamples);
+        SampleSummary b = SampleSummary::of(*other->find("samples"));
+        if (a.n == 0 || b.n == 0 || a.mean == 0) continue;
+
+        double change = 100.0 * (b.mean - a.mean) / fabs(a.mean);
+        double worse = higherIsBetter ? -change : change;
+        bool haveStats = a.n > 1 && b.n > 1;
+        double p = 1.0, ciLo = change, ciHi = change;
+        if (haveStats) {
+            double va = a.variance / a.n, vb = b.variance / b.n;
+            double se = sqrt(va + vb);
+            if (se > 0) {
+                double df = (va + vb) * (va + vb) /
+                            (va * va / (a.n - 1) + vb * vb / (b.n - 1));
+                p = StudentT::twoSidedP(fabs(b.mean - a.mean) / se, df);
+                double half = StudentT::critical(1 - confidence, df) * se;
+                ciLo = 100.0 * (b.mean - a.mean - half) / fabs(a.mean);
+                ciHi = 100.0 * (b.mean - a.mean + half) / fabs(a.mean);
+            } else {
+                p = a.mean == b.mean ? 1.0 : 0.0;
+            }
+        }
+        bool significant = !haveStats || p < 1 - confidence;
+        string verdict = "ok";
+        if (worse > threshold && significant) {
+            verdict = haveStats ? "REGRESSION" : "REGRESSION (single run)";
+            regressions++;
+        } else if (worse < -threshold && significant) {
+            verdict = "improved";
+        } else if (fabs(change) > threshold) {
+            verdict = "noise";
+        }
+        ostringstream ci;
+        ci << fixed << setprecision(1) << "[" << ciLo << "%, " << ciHi << "%]";
+        cout << left << setw(40) << field.first << right << fixed << setprecision(3)
+             << setw(14) << a.mean << setw(14) << b.mean << setprecision(1) << setw(9) << change << "%"
+             << setw(24) << ci.str() << setprecision(3) << setw(9) << p << "  " << verdict << endl;
+    }
+    cout.unsetf(ios::floatfield);
+    cout << setprecision(6);
+    cout << regressions << " regression(s) beyond " << threshold << "% at "
+         << confidence * 100 << "% confidence" << endl;
+    return regressions ? 1 : 0;
+}
+
+// ========================= TRACE REPLAY =========================
+// Replays a recorded trace against a fresh FileSystem. Clients are assigned
+// to threads round-robin, so each client's operations keep their order, and
+// operations on a file shared between clients wait for their turn in the
+// recorded order. File names and contents are synthesized from the recorded
+// name hash, size and timestamp, which makes the final state predictable and
+// checkable.
+struct ReplayOptions {
+    size_t threads = 1;
+    bool timed = false;        // honour recorded inter-arrival times
+    bool ordered = true;       // false: shared files race and cannot be verified
+    size_t cacheSize = 1024;
+};
+
+struct ReplayResult {
+    double seconds = 0;
+    uint64_t ops = 0;
+    uint64_t outcomeMismatches = 0;   // op succeeded/failed differently than recorded
+    uint64_t verifiedFiles = 0;
+    uint64_t checksumMismatches = 0;
+    uint64_t unverifiableFiles = 0;   // shared across clients in an unordered multi-threaded replay
+    CacheStats stats;
+};
+
+class TraceReplayer {
+private:
+    const vector<TraceRecord>& records;
+    ReplayOptions opts;
+    unordered_map<uint64_t, string> names;
+    unordered_map<uint64_t, bool> sharedFiles;   // touched by more than one client
+    unordered_map<uint64_t, uint32_t> nameIds;   // dense index for the turn counters
+    vector<uint32_t> turnOf;                     // each record's position among its file's records
+
+    static string contentFor(const TraceRecord& r) {
+        string content(r.size, static_cast<char>('a' + r.timestampNs % 26));
+        string stamp = to_string(r.timestampNs);
+        copy_n(stamp.begin(), min(stamp.size(), content.size()), content.begin());
+        return content;
+    }
+    const string& nameFor(uint64_t h) const { return names.at(h); }
+    bool orderIsDeterministic(uint64_t h) const { return opts.threads <= 1 || opts.ordered || !sharedFiles.at(h); }
+    bool needsTurn(uint64_t h) const { return opts.threads > 1 && opts.ordered && sharedFiles.at(h); }
+
+    bool apply(FileSystem& fs, const TraceRecord& r, string& buffer) const {
+        const string& name = nameFor(r.nameHash);
+        FsStatus status = FsStatus::IoError;
+        switch (r.op) {
+            case TraceOp::Create: status = fs.createFile(name, contentFor(r)); break;
+            case TraceOp::Read: status = fs.readFile(name, buffer); break;
+            case TraceOp::Write: status = fs.writeFile(name, contentFor(r)); break;
+            case TraceOp::Delete: status = fs.deleteFile(name); break;
+        }
+        return status == FsStatus::Ok;
+    }
+public:
+    TraceReplayer(const vector<TraceRecord>& recs, const ReplayOptions& o) : records(recs), opts(o) {
+        unordered_map<uint64_t, uint32_t> firstClient;
+        for (const auto& r : records) {
+            if (!names.count(r.nameHash)) {
+                ostringstream os;
+                os << "f" << hex << setw(16) << setfill('0') << r.nameHash;
+                names[r.nameHash] = os.str();
+                firstClient[r.nameHash] = r.client;
+                sharedFiles[r.nameHash] = false;
+            } else if (firstClient[r.nameHash] != r.client) {
+                sharedFiles[r.nameHash] = true;
+            }
+        }
+        vector<uint32_t> seen;
+        for (const auto& r : records) {
+            auto id = nameIds.emplace(r.nameHash, static_cast<uint32_t>(nameIds.size())).first->second;
+            if (id == seen.size()) seen.push_back(0);
+            turnOf.push_back(seen[id]++);
+        }
+    }
+
+    ReplayResult run() const {
+        ReplayResult result;
+        FileSystem fs(opts.cacheSize);
+        fs.setVerbose(false);
+
+        // Files that already existed when recording started are created up front.
+        unordered_map<uint64_t, bool> seen;
+        for (const auto& r : records) {
+            if (seen.count(r.nameHash)) continue;
+            seen[r.nameHash] = true;
+            if (r.op != TraceOp::Create && !r.failed) fs.createFile(nameFor(r.nameHash), contentFor(r));
+        }
+
+        size_t threads = max<size_t>(1, opts.threads);
+        vector<vector<size_t>> perThread(threads);
+        for (size_t i = 0; i < records.size(); i++) perThread[records[i].client % threads].push_back(i);
+
+        atomic<uint64_t> mismatches{0};
+        // Next record position allowed to run on each shared file. Records
+        // are in timestamp order, which every thread's list and every file's
+        // turns follow, so the earliest pending record can always proceed.
+        unique_ptr<atomic<uint32_t>[]> turns(new atomic<uint32_t>[nameIds.size()]());
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (size_t t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                uint64_t local = 0;
+                string buffer;
+                for (size_t idx : perThread[t]) {
+                    const TraceRecord& r = records[idx];
+                    if (opts.timed) this_thread::sleep_until(start + chrono::nanoseconds(r.timestampNs));
+                    atomic<uint32_t>* turn = needsTurn(r.nameHash) ? &turns[nameIds.at(r.nameHash)] : nullptr;
+                    if (turn) {
+                        while (turn->load(memory_order_acquire) != turnOf[idx]) this_thread::yield();
+                    }
+                    if (apply(fs, r, buffer) == r.failed && orderIsDeterministic(r.nameHash)) local++;
+                    if (turn) turn->store(turnOf[idx] + 1, memory_order_release);
+                }
+                mismatches += local;
+            });
+        }
+        for (auto& w : workers) w.join();
+        result.seconds = secondsSince(start);
+        result.ops = records.size();
+        result.outcomeMismatches = mismatches;
+        result.stats = fs.getStats();
+        verify(fs, result);
+        return result;
+    }
+
+    // Rebuilds the expected final state from the trace and checks every file.
+    void verify(FileSystem& fs, ReplayResult& result) const {
+        struct Expected {
+            bool exists = false;
+            uint64_t checksum = 0;
+        };
+        unordered_map<uint64_t, Expected> expected;
+        for (const auto& r : records) {
+            auto inserted = expected.emplace(r.nameHash, Expected());
+            Expected& e = inserted.first->second;
+            if (inserted.second) {
+                if (r.op != TraceOp::Create && !r.failed) {
+                    e.exists = true;
+                    e.checksum = fnv1a64(contentFor(r));
+                }
+            }
+            if (r.failed) continue;
+            if (r.op == TraceOp::Create || r.op == TraceOp::Write) {
+                e.exists = true;
+                e.checksum = fnv1a64(contentFor(r));
+            } else if (r.op == TraceOp::Delete) {
+                e.exists = false;
+            }
+        }
+        for (const auto& entry : expected) {
+            const Expected& e = entry.second;
+            if (!orderIsDeterministic(entry.first)) {
+                result.unverifiableFiles++;
+                continue;
+            }
+            string content;
+            FsStatus status = fs.readFile(nameFor(entry.first), content);
+            bool ok = e.exists ? status == FsStatus::Ok && fnv1a64(content) == e.checksum
+                               : status == FsStatus::NotFound;
+            result.verifiedFiles++;
+            if (!ok) result.checksumMismatches++;
+        }
+    }
+};
+
+int runReplayCommand(const CommandLine& cmd) {
+    if (cmd.positional.empty()) {
+        cerr << "usage: filesystem replay <trace> [--threads=N] [--timed] [--unordered] [--cache=N] [--runs=N] [--json=path]"
+             << endl;
+        return 2;
+    }
+    vector<TraceRecord> records;
+    if (!TraceRecorder::load(cmd.positional[0], records)) {
+        cerr << "Cannot read trace '" << cmd.positional[0] << "'" << endl;
+        return 1;
+    }
+    ReplayOptions opts;
+    opts.threads = cmd.getInt("threads", 1);
+    opts.timed = cmd.has("timed");
+    opts.ordered = !cmd.has("unordered");
+    opts.cacheSize = cmd.getInt("cache", 1024);
+    int runs = cmd.getInt("runs", 1);
+
+    BenchReport report("replay");
+    report.param("trace", cmd.positional[0]);
+    report.param("records", to_string(records.size()));
+    report.param("threads", to_string(opts.threads));
+    report.param("timed", opts.timed ? "true" : "false");
+    if (!opts.ordered) report.param("ordered", "false");
+    report.param("cache", to_string(opts.cacheSize));
+    TraceReplayer replayer(records, opts);
+    uint64_t failures = 0;
+    for (int r = 0; r < runs; r++) {
+        ReplayResult res = replayer.run();
+        report.add("ops_per_sec", "ops/s", true, res.ops / res.seconds);
+        report.add("elapsed_ms", "ms", false, res.seconds * 1000);
+        report.add("hit_ratio", "ratio", true, res.stats.hitRatio());
+        cout << "Run " << r + 1 << ": " << res.ops << " ops, " << res.outcomeMismatches
+             << " outcome mismatches, " << res.verifiedFiles << " files verified, "
+             << res.checksumMismatches << " checksum mismatches, " << res.unverifiableFiles
+             << " shared files skipped" << endl;
+        if (!res.verifiedFiles && res.unverifiableFiles) {
+            cerr << "WARNING: no files were verified; every file is shared between clients and --unordered "
+                    "lets them race. Replay without --unordered to check content." << endl;
+        }
+        failures += res.checksumMismatches;
+    }
+    int rc = report.finish(cmd);
+    return failures ? 1 : rc;
+}
+
+// ========================= LOCAL SOCKET SERVER =========================
+// Serves one FileSystem over a Unix domain socket. Frames are length-prefixed
+// little-endian binary:
+//   request:  u32 length, u8 op, u32 id, u16 nameLen, name, payload
+//   response: u32 length, u32 id, u8 status, payload
+// The payload is the content for create/write, the destination for rename
+// and, in responses, the content of a read. Clients may pipeline any number
+// of requests; each connection's responses come back in request order. A
+// request too short to carry its id is answered by closing the connection
+// once the responses before it are sent; a length above MAX_FRAME closes it
+// as soon as the header arrives. A connection whose unsent responses reach
+// OUT_HIGH_WATER is not read from until they have gone out, so a client that
+// never reads cannot make the server buffer without bound.
+// N event loops each own an epoll set; the first also accepts connections
+// and hands them out round-robin.
+#ifdef __linux__
+enum class WireOp : uint8_t { Create = 1, Read = 2, Write = 3, Delete = 4, Rename = 5 };
+
+struct WireProtocol {
+    static constexpr uint32_t MAX_FRAME = 64u << 20;
+
+    static void put32(string& out, uint32_t v) {
+        for (int i = 0; i < 4; i++) out += static_cast<char>(v >> (8 * i));
+    }
+    static uint32_t get32(const char* p) {
+        uint32_t v = 0;
+        for (int i = 0; i < 4; i++) v |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+        return v;
+    }
+    static void encodeRequest(string& out, WireOp op, uint32_t id, const string& name, const string& payload) {
+        put32(out, static_cast<uint32_t>(7 + name.size() + payload.size()));
+        out += static_cast<char>(op);
+        put32(out, id);
+        out += static_cast<char>(name.size() & 0xff);
+        out += static_cast<char>(name.size() >> 8);
+        out += name;
+        out += payload;
+    }
+    static void encodeResponse(string& out, uint32_t id, FsStatus status, const string& payload) {
+        put32(out, static_cast<uint32_t>(5 + payload.size()));
+        put32(out, id);
+        out += static_cast<char>(status);
+        out += payload;
+    }
+    // Length of the complete frame at `p`, 0 if more bytes are needed
+    static size_t frameLength(const char* p, size_t available) {
+        if (available < 4) return 0;
+        size_t len = 4 + get32(p);
+        return available >= len ? len : 0;
+    }
+};
+
+static int serverWakeFd = -1;
+
+class SocketServer {
+private:
+    struct Connection {
+        int fd;
+        int loop;
+        string in;
+        string out;
+        size_t outPos = 0;
+        uint32_t events = EPOLLIN;   // as registered with epoll
+        bool closing = false;        // close once `out` is sent
+    };
+    static constexpr size_t OUT_HIGH_WATER = 4u << 20;
+
+    FileSystem& fs;
+    string path;
+    int listenFd = -1;
+    int wakeFd = -1;
+    vector<int> epollFds;
+    vector<thread> loops;
+    atomic<size_t> nextLoop{0};
+    mutex connMutex;
+    unordered_set<Connection*> live;
+    atomic<uint64_t> served{0};
+
+    static bool setNonBlocking(int fd) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+
+    void closeConnection(Connection* c) {
+        epoll_ctl(epollFds[c->loop], EPOLL_CTL_DEL, c->fd, nullptr);
+        close(c->fd);
+        lock_guard<mutex> lock(connMutex);
+        live.erase(c);
+        delete c;
+    }
+
+    void acceptAll() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            auto* c = new Connection{fd, static_cast<int>(nextLoop++ % epollFds.size()), "", ""};
+            {
+                lock_guard<mutex> lock(connMutex);
+                live.insert(c);
+            }
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.ptr = c;
+            epoll_ctl(epollFds[c->loop], EPOLL_CTL_ADD, fd, &ev);
+        }
+    }
+
+    // Returns false for a frame too short to carry a request id: it cannot
+    // be answered, so the connection is closed rather than left waiting
+    bool execute(const char* frame, size_t len, string& out, string& buffer) {
+        if (len < 11) return false;
+        WireOp op = static_cast<WireOp>(frame[4]);
+        uint32_t id = WireProtocol::get32(frame + 5);
+        size_t nameLen = static_cast<uint8_t>(frame[9]) | (static_cast<uint8_t>(frame[10]) << 8);
+        if (11 + nameLen > len) {
+            WireProtocol::encodeResponse(out, id, FsStatus::IoError, "");
+            return true;
+        }
+        string name(frame + 11, nameLen);
+        string payload(frame + 11 + nameLen, len - 11 - nameLen);
+        FsStatus status = FsStatus::IoError;
+        buffer.clear();
+        switch (op) {
+            case WireOp::Create: status = fs.createFile(name, move(payload)); break;
+            case WireOp::Read: status = fs.readFile(name, buffer); break;
+            case WireOp::Write: status = fs.writeFile(name, move(payload)); break;
+            case WireOp::Delete: status = fs.deleteFile(name); break;
+            case WireOp::Rename: status = fs.renameFile(name, payload); break;
+        }
+        WireProtocol::encodeResponse(out, id, status, status == FsStatus::Ok ? buffer : string());
+        served.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
+
+    static bool backedUp(const Connection* c) { return c->out.size() - c->outPos >= OUT_HIGH_WATER; }
+
+    // Reads only while the output has room, writes only while it is pending
+    void updateEvents(Connection* c) {
+        bool pending = c->outPos < c->out.size();
+        uint32_t events = (c->closing || backedUp(c) ? 0u : uint32_t(EPOLLIN)) | (pending ? uint32_t(EPOLLOUT) : 0u);
+        if (events == c->events) return;
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.ptr = c;
+        epoll_ctl(epollFds[c->loop], EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = events;
+    }
+
+    // Executes the complete frames in `in` until the output backs up;
+    // returns false if the connection should be closed
+    bool process(Connection* c, string& buffer) {
+        size_t pos = 0;
+        while (!backedUp(c)) {
+            size_t len = WireProtocol::frameLength(c->in.data() + pos, c->in.size() - pos);
+            if (!len) break;
+            if (!execute(c->in.data() + pos, len, c->out, buffer)) {
+                c->in.clear();
+                c->closing = true;   // answer the frames before it, then hang up
+                return true;
+            }
+            pos += len;
+        }
+        c->in.erase(0, pos);
+        return c->in.size() < 4 || WireProtocol::get32(c->in.data()) <= WireProtocol::MAX_FRAME;
+    }
+
+    // Returns false if the connection should be closed
+    bool flush(Connection* c, string& buffer) {
+        while (true) {
+            while (c->outPos < c->out.size()) {
+                ssize_t n = ::send(c->fd, c->out.data() + c->outPos, c->out.size() - c->outPos, MSG_NOSIGNAL);
+                if (n < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                    return false;
+                }
+                c->outPos += n;
+            }
+            if (c->outPos < c->out.size()) break;
+            c->out.clear();
+            c->outPos = 0;
+            if (c->closing) return false;
+            // Frames held back while the output was backed up; the socket
+            // may have nothing new to wake the loop for them
+            if (c->in.size() < 4) break;
+            if (!process(c, buffer)) return false;
+            if (c->out.empty()) break;
+        }
+        updateEvents(c);
+        return true;
+    }
+
+    bool readable(Connection* c, string& buffer) {
+        char chunk[64 * 1024];
+        while (!c->closing && !backedUp(c)) {
+            ssize_t n = ::recv(c->fd, chunk, sizeof(chunk), 0);
+            if (n == 0) return false;
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return false;
+            }
+            c->in.append(chunk, n);
+            if (!process(c, buffer)) return false;
+        }
+        return flush(c, buffer);
+    }
+
+    void runLoop(int index) {
+        epoll_event events[64];
+        string buffer;
+        while (true) {
+            int n = epoll_wait(epollFds[index], events, 64, -1);
+            if (n < 0 && errno == EINTR) continue;
+            for (int i = 0; i < n; i++) {
+                void* tag = events[i].data.ptr;
+                if (tag == &wakeFd) return;
+                if (tag == &listenFd) {
+                    acceptAll();
+                    continue;
+                }
+                auto* c = static_cast<Connection*>(tag);
+                bool ok = true;
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) ok = false;
+                if (ok && (events[i].events & EPOLLIN)) ok = readable(c, buffer);
+                if (ok && (events[i].events & EPOLLOUT)) ok = flush(c, buffer);
+                if (!ok) closeConnection(c);
+            }
+        }
+    }
+public:
+    SocketServer(FileSystem& f, const string& p) : fs(f), path(p) {}
+    ~SocketServer() {
+        stop();
+        for (auto* c : live) {
+            close(c->fd);
+            delete c;
+        }
+        for (int fd : epollFds) close(fd);
+        if (wakeFd >= 0) close(wakeFd);
+        if (listenFd >= 0) {
+            close(listenFd);
+            unlink(path.c_str());
+        }
+    }
+
+    bool start(size_t workers) {
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path)) return false;
+        addr.sun_family = AF_UNIX;
+        copy(path.begin(), path.end(), addr.sun_path);
+        unlink(path.c_str());
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 || !setNonBlocking(listenFd) ||
+            bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listenFd, 512) < 0) {
+            return false;
+        }
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakeFd < 0) return false;
+        serverWakeFd = wakeFd;
+        for (size_t i = 0; i < max<size_t>(1, workers); i++) {
+            int ep = epoll_create1(EPOLL_CLOEXEC);
+            if (ep < 0) return false;
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.ptr = &wakeFd;
+            epoll_ctl(ep, EPOLL_CTL_ADD, wakeFd, &ev);
+            if (i == 0) {
+                ev.data.ptr = &listenFd;
+                epoll_ctl(ep, EPOLL_CTL_ADD, listenFd, &ev);
+            }
+            epollFds.push_back(ep);
+        }
+        for (size_t i = 0; i < epollFds.size(); i++) loops.emplace_back([this, i] { runLoop(static_cast<int>(i)); });
+        return true;
+    }
+
+    // Wakes every loop; the eventfd stays readable so all of them see it
+    void stop() {
+        if (wakeFd >= 0) {
+            uint64_t one = 1;
+            ssize_t ignored = write(wakeFd, &one, sizeof(one));
+            (void)ignored;
+        }
+        for (auto& t : loops) {
+            if (t.joinable()) t.join();
+        }
+        serverWakeFd = -1;
+    }
+
+    void wait() {
+        for (auto& t : loops) {
+            if (t.joinable()) t.join();
+        }
+    }
+
+    uint64_t requestsServed() const { return served.load(); }
+};
+
+int runServeCommand(const CommandLine& cmd) {
+    if (cmd.positional.empty()) {
+        cerr << "usage: filesystem serve <socket-path> [--workers=N] [--cache=N] [--autosize --mem-target=BYTES ...]" << endl;
+        return 2;
+    }
+    FileSystem fs(cmd.getInt("cache", 1024));
+    fs.setVerbose(false);
+    SocketServer server(fs, cmd.positional[0]);
+    size_t workers = cmd.getInt("workers", max(1u, thread::hardware_concurrency()));
+    if (!server.start(workers)) {
+        cerr << "Cannot listen on '" << cmd.positional[0] << "': " << strerror(errno) << endl;
+        return 1;
+    }
+    auto onSignal = [](int) {
+        uint64_t one = 1;
+        if (serverWakeFd >= 0) {
+            ssize_t ignored = write(serverWakeFd, &one, sizeof(one));
+            (void)ignored;
+        }
+    };
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    MemoryPressureController autosizer(fs, MemoryControlConfig::fromCommandLine(cmd));
+    if (cmd.has("autosize")) autosizer.start();
+    cout << "Serving on '" << cmd.positional[0] << "' with " << workers << " event loop(s); Ctrl-C to stop" << endl;
+    server.wait();
+    autosizer.stop();
+    cout << "Served " << server.requestsServed() << " requests" << endl;
+    fs.printStats();
+    return 0;
+}
+
+// ---- load-generating client ----
+class SocketClient {
+private:
+    int fd = -1;
+
+    bool writeAll(const string& data) {
+        size_t pos = 0;
+        while (pos < data.size()) {
+            ssize_t n = ::send(fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            pos += n;
+        }
+        return true;
+    }
+    bool readExact(char* p, size_t len) {
+        while (len) {
+            ssize_t n = ::recv(fd, p, len, 0);
+            if (n <= 0) return false;
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+public:
+    ~SocketClient() {
+        if (fd >= 0) close(fd);
+    }
+    bool connectTo(const string& path) {
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path)) return false;
+        addr.sun_family = AF_UNIX;
+        copy(path.begin(), path.end(), addr.sun_path);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        return fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    }
+    // Makes receive() give up after `ms` without data
+    bool setReceiveTimeout(int ms) {
+        timeval tv{ms / 1000, (ms % 1000) * 1000};
+        return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0;
+    }
+    bool send(const string& frames) { return writeAll(frames); }
+    bool receive(uint32_t& id, FsStatus& status, string& payload) {
+        char header[9];
+        if (!readExact(header, 4)) return false;
+        uint32_t len = WireProtocol::get32(header);
+        if (len < 5 || len > WireProtocol::MAX_FRAME || !readExact(header + 4, 5)) return false;
+        id = WireProtocol::get32(header + 4);
+        status = static_cast<FsStatus>(header[8]);
+        payload.resize(len - 5);
+        return payload.empty() || readExact(&payload[0], payload.size());
+    }
+};
+
+// Each connection keeps --pipeline requests in flight: it sends a window of
+// requests in one write, then collects the window's responses.
+int runClientCommand(const CommandLine& cmd) {
+    if (cmd.positional.empty()) {
+        cerr << "usage: filesystem client <socket-path> [--connections=N] [--ops=N] [--pipeline=N]"
+                " [--files=N] [--size=N] [--read-ratio=R] [--zipf=S] [--runs=N] [--json=path]" << endl;
+        return 2;
+    }
+    string path = cmd.positional[0];
+    size_t connections = cmd.getInt("connections", 4);
+    uint64_t ops = cmd.getInt("ops", 100000);
+    size_t depth = max<long long>(1, cmd.getInt("pipeline", 16));
+    size_t files = cmd.getInt("files", 1000);
+    string payload(cmd.getInt("size", 64), 'x');
+    double readRatio = cmd.getDouble("read-ratio", 0.9);
+    int runs = cmd.getInt("runs", 1);
+    ZipfGenerator zipf(files, cmd.getDouble("zipf", 0.99));
+    vector<string> names;
+    for (size_t i = 0; i < files; i++) names.push_back("file" + to_string(i) + ".dat");
+
+    {
+        SocketClient setup;
+        if (!setup.connectTo(path)) {
+            cerr << "Cannot connect to '" << path << "'" << endl;
+            return 1;
+        }
+        string frames;
+        for (size_t i = 0; i < files; i++) WireProtocol::encodeRequest(frames, WireOp::Create, i, names[i], payload);
+        setup.send(frames);
+        uint32_t id;
+        FsStatus status;
+        string body;
+        for (size_t i = 0; i < files; i++) setup.receive(id, status, body);
+    }
+
+    BenchReport report("client");
+    report.param("connections", to_string(connections));
+    report.param("ops_per_connection", to_string(ops));
+    report.param("pipeline", to_string(depth));
+    report.param("size", to_string(payload.size()));
+    for (int r = 0; r < runs; r++) {
+        vector<vector<double>> latencies(connections);
+        atomic<uint64_t> errors{0};
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (size_t t = 0; t < connections; t++) {
+            workers.emplace_back([&, t] {
+                SocketClient client;
+                if (!client.connectTo(path)) {
+                    errors += ops;
+                    return;
+                }
+                mt19937_64 rng(1234 + t);
+                uniform_real_distribution<double> pick(0.0, 1.0);
+                string frames, body;
+                latencies[t].reserve(ops);
+                for (uint64_t sent = 0; sent < ops; ) {
+                    size_t window = min<uint64_t>(depth, ops - sent);
+                    frames.clear();
+                    for (size_t i = 0; i < window; i++) {
+                        const string& name = names[zipf.next(rng)];
+                        bool read = pick(rng) < readRatio;
+                        WireProtocol::encodeRequest(frames, read ? WireOp::Read : WireOp::Write,
+                                                    sent + i, name, read ? string() : payload);
+                    }
+                    auto sentAt = chrono::steady_clock::now();
+                    if (!client.send(frames)) {
+                        errors += ops - sent;
+                        return;
+                    }
+                    for (size_t i = 0; i < window; i++) {
+                        uint32_t id;
+                        FsStatus status;
+                        if (!client.receive(id, status, body)) {
+                            errors += ops - sent;
+                            return;
+                        }
+                        if (status != FsStatus::Ok) errors++;
+                        latencies[t].push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - sentAt).count());
+                    }
+                    sent += window;
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
+        double secs = secondsSince(start);
+        vector<double> all;
+        for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+        sort(all.begin(), all.end());
+        auto pct = [&](double q) { return all.empty() ? 0.0 : all[min(all.size() - 1, static_cast<size_t>(q * all.size()))]; };
+        report.add("ops_per_sec", "ops/s", true, all.size() / secs);
+        report.add("latency_p50_us", "us", false, pct(0.50));
+        report.add("latency_p99_us", "us", false, pct(0.99));
+        report.add("latency_p999_us", "us", false, pct(0.999));
+        report.add("errors", "count", false, errors.load());
+    }
+    return report.finish(cmd);
+}
+
+// Pipelined responses come back in order; a short frame closes the
+// connection after the responses before it, an oversized length closes it
+// at once; a client that does not read stops being read from and is served
+// in full once it does.
+void addServerSelfTests(SelfTest& t) {
+    t.add("socket server framing and backpressure", [](SelfTest& t) {
+        FileSystem fs(64);
+        fs.setVerbose(false);
+        string path = "/tmp/selftest_fs_" + to_string(getpid()) + ".sock";
+        SocketServer server(fs, path);
+        if (!server.start(1)) {
+            t.check(false, "cannot listen on '" + path + "'");
+            return;
+        }
+        auto open = [&](SocketClient& c) {
+            t.check(c.connectTo(path) && c.setReceiveTimeout(2000), "cannot connect to '" + path + "'");
+        };
+        uint32_t id = 0;
+        FsStatus status = FsStatus::IoError;
+        string payload;
+        {
+            SocketClient c;
+            open(c);
+            string frames;
+            WireProtocol::encodeRequest(frames, WireOp::Create, 1, "f", "hello");
+            WireProtocol::encodeRequest(frames, WireOp::Read, 2, "f", "");
+            WireProtocol::encodeRequest(frames, WireOp::Read, 3, "missing", "");
+            c.send(frames);
+            bool ok = c.receive(id, status, payload) && id == 1 && status == FsStatus::Ok;
+            ok = ok && c.receive(id, status, payload) && id == 2 && status == FsStatus::Ok && payload == "hello";
+            ok = ok && c.receive(id, status, payload) && id == 3 && status == FsStatus::NotFound;
+            t.check(ok, "pipelined responses out of order or wrong");
+        }
+        {
+            SocketClient c;
+            open(c);
+            string frames;
+            WireProtocol::encodeRequest(frames, WireOp::Read, 7, "f", "");
+            WireProtocol::put32(frames, 3);
+            frames += "abc";
+            c.send(frames);
+            t.check(c.receive(id, status, payload) && id == 7 && payload == "hello", "response before a short frame lost");
+            t.check(!c.receive(id, status, payload), "short frame did not close the connection");
+        }
+        {
+            SocketClient c;
+            open(c);
+            string header;
+            WireProtocol::put32(header, WireProtocol::MAX_FRAME + 1);
+            c.send(header);
+            t.check(!c.receive(id, status, payload), "oversized length did not close the connection");
+        }
+        {
+            const uint32_t reads = 200;
+            const size_t size = 256 << 10;
+            fs.createFile("big", string(size, 'x'));
+            SocketClient c;
+            open(c);
+            string frames;
+            for (uint32_t i = 0; i < reads; i++) WireProtocol::encodeRequest(frames, WireOp::Read, 100 + i, "big", "");
+            uint64_t before = server.requestsServed();
+            c.send(frames);
+            this_thread::sleep_for(chrono::milliseconds(200));
+            uint64_t served = server.requestsServed() - before;
+            t.check(served < reads, "served all " + to_string(reads) + " reads to a client that reads nothing");
+            uint32_t received = 0;
+            while (received < reads && c.receive(id, status, payload) && id == 100 + received && payload.size() == size) {
+                received++;
+            }
+            t.check(received == reads, "received " + to_string(received) + " of " + to_string(reads) + " responses");
+        }
+    });
+}
+#else
+void addServerSelfTests(SelfTest&) {}
+int runServeCommand(const CommandLine&) {
+    cerr << "serve needs Linux (epoll)" << endl;
+    return 2;
+}
+int runClientCommand(const CommandLine&) {
+    cerr << "client needs Linux (epoll)" << endl;
+    return 2;
+}
+#endif
+
+// ========================= COMMAND SHELL =========================
+// Line-oriented interpreter over one FileSystem, driven interactively or
+// from a script file. `#` starts a comment. Content arguments run to the
+// end of the line, so they may contain spaces.
+class Shell {
+private:
+    FileSystem& fs;
+    bool quiet;
+    bool inTransaction = false;
+    Transaction pending;
+    string tracePath;
+    vector<shared_ptr<WatchQueue>> watches;
+    MemoryControlConfig memoryConfig;
+    unique_ptr<MemoryPressureController> autosizer;
+    PartitionControlConfig partitionConfig;
+    unique_ptr<UtilityPartitioner> rebalancer;
+
+    static void split(const string& line, string& word, string& rest) {
+        size_t start = line.find_first_not_of(" \t");
+        if (start == string::npos) {
+            word.clear();
+            rest.clear();
+            return;
+        }
+        size_t end = line.find_first_of(" \t", start);
+        word = line.substr(start, end == string::npos ? string::npos : end - start);
+        size_t next = end == string::npos ? string::npos : line.find_first_not_of(" \t", end);
+        rest = next == string::npos ? "" : line.substr(next);
+    }
+    static vector<string> words(const string& text) {
+        vector<string> out;
+        istringstream in(text);
+        string w;
+        while (in >> w) out.push_back(w);
+        return out;
+    }
+    void report(FsStatus status) const {
+        if (status != FsStatus::Ok) cout << "error: " << statusMessage(status) << endl;
+    }
+    // Parses a whole non-negative number argument, as the flags are parsed
+    static bool count(const string& text, uint64_t& out) {
+        try {
+            long long value = CommandLine::parseInt("", text);
+            if (value < 0) return false;
+            out = static_cast<uint64_t>(value);
+            return true;
+        } catch (const UsageError&) {
+            return false;
+        }
+    }
+    void printHelp() const {
+        cout << "Commands:\n"
+                "  create <name> [content]   write <name> <content>   read <name> [nocache]\n"
+                "  delete <name>             rename <from> <to>       ls\n"
+                "  begin / commit / abort    group create/write/delete/rename atomically\n"
+                "  stats                     bench [--ops=N --threads=N --files=N ...]\n"
+                "  record <path> | record off                         quiet on|off\n"
+                "  watch <name> | watch <prefix>*                     events\n"
+                "  stat <name>               ttl <ms> [name]\n"
+                "  pin <name>                unpin <name>             priority <name> low|normal|high\n"
+                "  advise <name> normal|willneed|dontneed|sequential|random|noreuse\n"
+                "  admit <max-bytes>         files above it bypass the cache (0 = no limit)\n"
+                "  resize <capacity>         memory                   lfu-aging <period> [max-frequency]\n"
+                "  policy classic|adaptive   split the cache between LRU and LFU by ghost hits\n"
+                "  partition <name> <prefix> <quota> [hard|soft] [lru|lfu]   unpartition <name>\n"
+                "  rebalance on|off|step     reallocate partition quotas by utility; bare: report\n"
+                "  autosize on [target-bytes] | autosize off | autosize step\n"
+                "  echo <text>               help                     exit" << endl;
+    }
+    void bench(const string& args) {
+        vector<string> argv = words(args);
+        CommandLine cmd(argv);
+        WorkloadConfig cfg;
+        size_t threads;
+        try {
+            cfg = WorkloadConfig::fromCommandLine(cmd);
+            threads = cmd.getInt("threads", 1);
+        } catch (const UsageError& e) {
+            cout << "error: " << e.what() << endl;
+            return;
+        }
+        if (!cmd.has("ops")) cfg.opsPerThread = 10000;
+        Workload workload(cfg);
+        bool wasQuiet = quiet;
+        setQuiet(true);
+        workload.populate(fs);
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (size_t t = 0; t < threads; t++) {
+            workers.emplace_back([this, &workload, t] { workload.run(fs, t); });
+        }
+        for (auto& w : workers) w.join();
+        double secs = secondsSince(start);
+        setQuiet(wasQuiet);
+        cout << "bench: " << cfg.opsPerThread * threads << " ops on " << threads << " thread(s) in "
+             << fixed << setprecision(3) << secs * 1000 << " ms ("
+             << setprecision(0) << cfg.opsPerThread * threads / secs << " ops/s)" << endl;
+        cout.unsetf(ios::floatfield);
+        cout << setprecision(6);
+    }
+public:
+    Shell(FileSystem& f, bool q) : fs(f), quiet(q) { fs.setVerbose(!quiet); }
+
+    void setQuiet(bool q) {
+        quiet = q;
+        fs.setVerbose(!quiet);
+    }
+
+    void setMemoryControl(const MemoryControlConfig& cfg) { memoryConfig = cfg; }
+    void setPartitionControl(const PartitionControlConfig& cfg) { partitionConfig = cfg; }
+
+    // Returns false once the session should end
+    bool execute(const string& line) {
+        string command, rest;
+        split(line.substr(0, line.find('#')), command, rest);
+        if (command.empty()) return true;
+        string name, content;
+        split(rest, name, content);
+
+        // File operations are checked the same way whether or not they are
+        // queued in a transaction
+        bool fileOp = command == "create" || command == "write" || command == "delete" || command == "rename";
+        if (fileOp && (name.empty() || (command == "rename" && words(content).empty()))) {
+            cout << (command == "create" ? "usage: create <name> [content]"
+                     : command == "write" ? "usage: write <name> <content>"
+                     : command == "delete" ? "usage: delete <name>" : "usage: rename <from> <to>") << endl;
+            return true;
+        }
+        if (inTransaction && fileOp) {
+            if (command == "create") pending.create(name, content);
+            else if (command == "write") pending.write(name, content);
+            else if (command == "delete") pending.remove(name);
+            else pending.rename(name, words(content)[0]);
+            return true;
+        }
+
+        if (command == "create") {
+            report(fs.createFile(name, move(content)));
+        } else if (command == "write") {
+            report(fs.writeFile(name, move(content)));
+        } else if (command == "read") {
+            string out;
+            FsStatus status = fs.readFile(name, out, content == "nocache" ? CacheMode::Bypass : CacheMode::Default);
+            if (status != FsStatus::Ok) report(status);
+            else if (!quiet) cout << out << endl;
+        } else if (command == "delete") {
+            report(fs.deleteFile(name));
+        } else if (command == "rename") {
+            report(fs.renameFile(name, words(content)[0]));
+        } else if (command == "ls") {
+            fs.listFiles();
+        } else if (command == "stats") {
+            fs.printStats();
+        } else if (command == "begin") {
+            inTransaction = true;
+            pending = Transaction();
+        } else if (command == "commit" || command == "abort") {
+            if (!inTransaction) {
+                cout << "error: no transaction in progress" << endl;
+            } else {
+                inTransaction = false;
+                if (command == "commit") {
+                    size_t failed = 0;
+                    FsStatus status = fs.commit(move(pending), &failed);
+                    if (status != FsStatus::Ok) {
+                        cout << "error: operation " << failed << ": " << statusMessage(status)
+                             << " (transaction rolled back)" << endl;
+                    }
+                }
+                pending = Transaction();
+            }
+        } else if (command == "bench") {
+            bench(rest);
+        } else if (command == "record") {
+            if (name == "off") {
+                uint64_t n = fs.stopRecording();
+                if (!tracePath.empty()) cout << "Recorded " << n << " operations to '" << tracePath << "'" << endl;
+                tracePath.clear();
+            } else if (!fs.startRecording(name)) {
+                cout << "error: cannot open trace file '" << name << "'" << endl;
+            } else {
+                tracePath = name;
+            }
+        } else if (command == "stat") {
+            auto meta = fs.stat(name);
+            if (!meta) {
+                report(meta.status());
+            } else {
+                const FileMetadata& m = meta.value();
+                cout << name << ": size " << m.size << ", version " << m.version << ", ctime " << m.ctimeMs
+                     << ", mtime " << m.mtimeMs << ", atime " << m.atimeMs << " (ms since epoch)" << endl;
+            }
+        } else if (command == "pin") {
+            report(fs.pin(name));
+        } else if (command == "unpin") {
+            report(fs.unpin(name));
+        } else if (command == "priority") {
+            vector<string> level = words(content);
+            if (level.empty() || (level[0] != "low" && level[0] != "normal" && level[0] != "high")) {
+                cout << "usage: priority <name> low|normal|high" << endl;
+            } else {
+                report(fs.setPriority(name, level[0] == "low" ? CachePriority::Low
+                                          : level[0] == "high" ? CachePriority::High : CachePriority::Normal));
+            }
+        } else if (command == "autosize") {
+            MemoryControlConfig cfg = memoryConfig;
+            uint64_t target = 0;
+            if (name == "on" && !content.empty() && !count(content, target)) {
+                cout << "usage: autosize on [target-bytes] | autosize off | autosize step" << endl;
+            } else if (name == "on") {
+                if (!content.empty()) cfg.targetBytes = target;
+                autosizer = make_unique<MemoryPressureController>(fs, cfg);
+                autosizer->start();
+            } else if (name == "off") {
+                autosizer.reset();
+            } else if (name == "step") {
+                if (!autosizer) autosizer = make_unique<MemoryPressureController>(fs, memoryConfig);
+                autosizer->step();
+                autosizer->print();
+            } else {
+                cout << "usage: autosize on [target-bytes] | autosize off | autosize step" << endl;
+            }
+        } else if (command == "memory") {
+            if (autosizer) {
+                autosizer->print();
+            } else {
+                MemoryReading r = MemoryProbe::read();
+                cout << "Memory: usage " << r.usage() << " of limit " << r.limit() << " bytes (rss " << r.rssBytes
+                     << (r.cgroupLimit ? ", cgroup-limited" : ", no cgroup limit") << "); autosize off" << endl;
+            }
+        } else if (command == "lfu-aging") {
+            vector<string> args = words(rest);
+            uint64_t period = 0, maxFrequency = INT_MAX;
+            if (args.empty() || !count(args[0], period) || (args.size() > 1 && !count(args[1], maxFrequency)) ||
+                maxFrequency > INT_MAX) {
+                cout << "usage: lfu-aging <period> [max-frequency]" << endl;
+            } else {
+                fs.setLfuAging(period, static_cast<int>(maxFrequency));
+            }
+        } else if (command == "partition") {
+            vector<string> args = words(rest);
+            uint64_t quota = 0;
+            if (args.size() < 3 || !count(args[2], quota)) {
+                cout << "usage: partition <name> <prefix> <quota> [hard|soft] [lru|lfu]" << endl;
+            } else {
+                bool hard = find(args.begin() + 3, args.end(), "soft") == args.end();
+                bool lfu = find(args.begin() + 3, args.end(), "lfu") != args.end();
+                report(fs.setPartition(args[0], args[1], quota, hard, lfu ? EvictionPolicy::Lfu : EvictionPolicy::Lru));
+            }
+        } else if (command == "rebalance") {
+            if (name == "on") {
+                rebalancer = make_unique<UtilityPartitioner>(fs, partitionConfig);
+                rebalancer->start();
+            } else if (name == "off") {
+                rebalancer.reset();
+            } else if (name == "step" || name.empty()) {
+                if (!rebalancer) rebalancer = make_unique<UtilityPartitioner>(fs, partitionConfig);
+                if (name == "step") rebalancer->step();
+                rebalancer->print();
+            } else {
+                cout << "usage: rebalance on|off|step" << endl;
+            }
+        } else if (command == "unpartition") {
+            if (name.empty()) cout << "usage: unpartition <name>" << endl;
+            else report(fs.removePartition(name));
+        } else if (command == "policy") {
+            if (name == "classic") fs.setCachePolicy(CachePolicy::Classic);
+            else if (name == "adaptive") fs.setCachePolicy(CachePolicy::Adaptive);
+            else cout << "usage: policy classic|adaptive" << endl;
+        } else if (command == "resize") {
+            uint64_t capacity = 0;
+            if (!count(name, capacity)) cout << "usage: resize <capacity>" << endl;
+            else fs.resizeCache(capacity);
+        } else if (command == "admit") {
+            uint64_t limit = 0;
+            if (!count(name, limit)) cout << "usage: admit <max-bytes>" << endl;
+            else fs.setAdmissionLimit(limit);
+        } else if (command == "advise") {
+            static const map<string, Advice> hints = {
+                {"normal", Advice::Normal}, {"willneed", Advice::WillNeed}, {"dontneed", Advice::DontNeed},
+                {"sequential", Advice::Sequential}, {"random", Advice::Random}, {"noreuse", Advice::NoReuse}};
+            vector<string> hint = words(content);
+            auto it = hint.empty() ? hints.end() : hints.find(hint[0]);
+            if (it == hints.end()) cout << "usage: advise <name> normal|willneed|dontneed|sequential|random|noreuse" << endl;
+            else report(fs.advise(name, it->second));
+        } else if (command == "ttl") {
+            vector<string> args = words(rest);
+            uint64_t ttl = 0;
+            if (args.empty() || !count(args[0], ttl)) cout << "usage: ttl <ms> [name]" << endl;
+            else if (args.size() == 1) fs.setCacheTtl(ttl);
+            else report(fs.setCacheTtl(args[1], ttl));
+        } else if (command == "watch") {
+            if (name.empty()) cout << "usage: watch <name> | watch <prefix>*" << endl;
+            else if (name.back() == '*') watches.push_back(fs.watch(name.substr(0, name.size() - 1), true));
+            else watches.push_back(fs.watch(name));
+        } else if (command == "events") {
+            vector<WatchEvent> events;
+            for (auto& w : watches) {
+                events.clear();
+                w->poll(events);
+                for (const auto& e : events) {
+                    cout << "[" << w->watchedPath() << (w->isPrefix() ? "*" : "") << "] #" << e.sequence << " "
+                         << watchEventName(e.kind) << " " << e.name << " (" << e.size << " bytes)" << endl;
+                }
+                if (w->droppedEvents()) cout << "[" << w->watchedPath() << "] " << w->droppedEvents() << " event(s) dropped" << endl;
+            }
+        } else if (command == "quiet") {
+            setQuiet(name != "off");
+        } else if (command == "echo") {
+            cout << rest << endl;
+        } else if (command == "help") {
+            printHelp();
+        } else if (command == "exit" || command == "quit") {
+            return false;
+        } else {
+            cout << "error: unknown command '" << command << "' (try 'help')" << endl;
+        }
+        return true;
+    }
+
+    int run(istream& in, bool interactive) {
+        string line;
+        while (true) {
+            if (interactive) cout << "fs> " << flush;
+            if (!getline(in, line)) break;
+            if (!execute(line)) break;
+        }
+        if (!tracePath.empty()) execute("record off");
+        return 0;
+    }
+};
+
+// Without a subcommand: `filesystem [script] [--quiet] [--cache=N] [--admit-max=BYTES]
+// [--policy=adaptive] [--autosize --mem-target=BYTES ...] [--rebalance-interval-ms=N ...]`
+// (see MemoryControlConfig and PartitionControlConfig for the rest)
+int runShell(const CommandLine& cmd) {
+    FileSystem fs(cmd.getInt("cache", 10));
+    fs.setAdmissionLimit(cmd.getInt("admit-max", 0));
+    if (cmd.get("policy") == "adaptive") fs.setCachePolicy(CachePolicy::Adaptive);
+    Shell shell(fs, cmd.has("quiet"));
+    shell.setMemoryControl(MemoryControlConfig::fromCommandLine(cmd));
+    shell.setPartitionControl(PartitionControlConfig::fromCommandLine(cmd));
+    if (cmd.has("autosize")) shell.execute("autosize on");
+    if (cmd.positional.empty()) return shell.run(cin, isatty(STDIN_FILENO));
+    ifstream script(cmd.positional[0]);
+    if (!script) {
+        cerr << "Cannot open script '" << cmd.positional[0] << "'" << endl;
+        return 1;
+    }
+    return shell.run(script, false);
+}
+
+int runCommand(int argc, char* argv[]) {
+    string command = argc > 1 ? argv[1] : "";
+    if (command == "workload") return runWorkloadCommand(CommandLine(argc, argv, 2));
+    if (command == "scale") return runScaleCommand(CommandLine(argc, argv, 2));
+    if (command == "footprint") return runFootprintCommand(CommandLine(argc, argv, 2));
+    if (command == "microbench") return runMicrobenchCommand(CommandLine(argc, argv, 2));
+    if (command == "alloc-check") return runAllocCheckCommand(CommandLine(argc, argv, 2));
+    if (command == "selftest") return runSelfTestCommand(CommandLine(argc, argv, 2));
+    if (command == "compare") return runCompareCommand(CommandLine(argc, argv, 2));
+    if (command == "serve") return runServeCommand(CommandLine(argc, argv, 2));
+    if (command == "client") return runClientCommand(CommandLine(argc, argv, 2));
+    if (command == "replay") return runReplayCommand(CommandLine(argc, argv, 2));
+    return runShell(CommandLine(argc, argv, 1));
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        return runCommand(argc, argv);
+    } catch (const UsageError& e) {
+        cerr << "error: " << e.what() << endl;
+        return 2;
+    }
 }